@@ -1,5 +1,6 @@
 #pragma once
 
+#include "header_index.h"
 #include "marshalling.h"
 #include "small_vector.h"
 
@@ -12,6 +13,16 @@ struct IPAddress {
   using ipv4_type = std::array<uint8_t, 4>;
   using ipv6_type = std::array<uint8_t, 16>;
   std::variant<ipv4_type, ipv6_type> data;
+
+  // so the variant is written as a tag and only the active address
+  template <typename Archive>
+  void marshal(Archive& ar) {
+    ar(data);
+  }
+  template <typename Archive>
+  void marshal(Archive& ar) const {
+    ar(data);
+  }
 };
 
 struct SomeRequest : marshalling::SerializedType<SomeRequest> {
@@ -34,8 +45,18 @@ struct SomeRequest : marshalling::SerializedType<SomeRequest> {
   };
   struct Location {
     IPAddress ip_address;
-    uint32_t market, country, region, state, asn;
+    uint32_t market{}, country{}, region{}, state{}, asn{};
     StringPtr market_iso, country_iso, region_code, state_code;
+    template <typename Archive>
+    void marshal(Archive& ar) {
+      ar(ip_address, market, country, region, state, asn,  //
+         market_iso, country_iso, region_code, state_code);
+    }
+    template <typename Archive>
+    void marshal(Archive& ar) const {
+      ar(ip_address, market, country, region, state, asn,  //
+         market_iso, country_iso, region_code, state_code);
+    }
   };
 
   // --- Data --- --- --- ---
@@ -45,6 +66,13 @@ struct SomeRequest : marshalling::SerializedType<SomeRequest> {
   Vector<Provider> providers;
   Vector<Header> headers;
 
+  // --- Lookup --- --- --- ---
+  // Finds a header by name, ignoring case, or nullptr.  Decoding
+  // builds an index over the headers so this is a hash probe.
+  const Header* find_header(std::string_view name) const {
+    return header_index_.find(headers, name);
+  }
+
   // --- Serialization --- --- --- ---
   template <typename Archive>
   void marshal(Archive& ar) {
@@ -54,6 +82,40 @@ struct SomeRequest : marshalling::SerializedType<SomeRequest> {
   void marshal(Archive& ar) const {
     ar(query, requirements, location, providers, headers, strings_);
   }
+  void after_load() { header_index_.build(headers); }
+
+  // the fields the response depends on, for rpc::ResponseCache
+  template <typename Archive>
+  void cache_key(Archive& ar) const {
+    ar(query.method, query.type, query.prefix,  //
+       location.market, location.country);
+  }
+
+ private:
+  HeaderIndex header_index_;
+};
+
+// -- Lookup
+// Has no containers, so it can be sent as a direct image
+// (see SerializedType::write_direct).  That needs the fields
+// to fill the object with no padding, so they're widest
+// first and `reserved` makes up the last word.
+struct LookupRequest : marshalling::SerializedType<LookupRequest> {
+  uint32_t market{0};
+  StringPtr worker_id;
+  StringPtr prefix;
+  IPAddress ip_address;
+  std::array<uint8_t, 7> reserved{};
+
+  // --- Serialization --- --- --- ---
+  template <typename Archive>
+  void marshal(Archive& ar) {
+    ar(market, worker_id, prefix, ip_address, reserved, strings_);
+  }
+  template <typename Archive>
+  void marshal(Archive& ar) const {
+    ar(market, worker_id, prefix, ip_address, reserved, strings_);
+  }
 };
 
 // -- Response
@@ -62,7 +124,7 @@ struct SomeResponse : marshalling::SerializedType<SomeResponse> {
   struct InitResponse {
     Vector<StringPtr> providers;
     Vector<StringPtr> origins;
-    bool is_special;
+    bool is_special{};
     template <typename Archive>
     void marshal(Archive& ar) {
       ar(providers, origins, is_special);
@@ -107,6 +169,7 @@ struct SomeResponse : marshalling::SerializedType<SomeResponse> {
        reason_log,              //
        strings_);
   }
+  uint32_t cache_ttl() const { return response.ttl; }
 };
 
 namespace marshalling {
@@ -122,6 +185,12 @@ StreamT& operator<<(
   os << *str;
   return os;
 }
+template <typename StreamT>
+StreamT& operator<<(
+    StreamT& os, const SerializedType<::darr::LookupRequest>::StringPtr& str) {
+  os << *str;
+  return os;
+}
 
 }  // namespace marshalling
 }  // namespace darr
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "rpc.h"
+
+//
+// A cache of encoded responses, keyed on the request fields
+// that decide them, so repeat requests skip both the handler
+// and serialization.
+//
+//     rpc::ResponseCache cache{100000};
+//     server.serve([&](uint32_t call_id, SomeRequest& req) {
+//       if (auto hit = cache.find(req))
+//         return server.respond(call_id, *hit);
+//       SomeResponse resp;
+//       ...
+//       server.respond(call_id, *cache.insert(req, resp));
+//     });
+//
+// The request type lists its key fields in a `cache_key`
+// method, just like `marshal`, and the response type gives
+// its time to live in seconds with `cache_ttl()`; zero isn't
+// cached.  Strings are keyed by content, so two requests with
+// equal fields make the same key however they were built.
+//
+// Entries are split over shards by hash, each with its own
+// lock and least recently used list, and are shared_ptrs so a
+// send can outlive an eviction.
+//
+
+namespace darr {
+namespace rpc {
+
+// an archive which appends the fields given to it to `bytes`
+struct CacheKeyBuilder {
+  std::string bytes;
+
+  template <typename... Types>
+  void operator()(const Types&... fields) {
+    (add(fields), ...);
+  }
+
+ private:
+  // StringPtr is the only thing we key on which dereferences to
+  // a C string
+  template <typename T, typename _ = void>
+  struct is_string_ptr : std::false_type {};
+  template <typename T>
+  struct is_string_ptr<T, std::enable_if_t<std::is_same<
+                              decltype(*std::declval<const T&>()),
+                              const char*>::value>> : std::true_type {};
+
+  template <typename T>
+  void add(const T& field) {
+    using marshalling::has_marshal_method;
+    if constexpr (is_string_ptr<T>::value) {
+      const char* s = *field;
+      bytes.append(s, std::strlen(s) + 1);
+    } else if constexpr (marshalling::is_variant<T>::value) {
+      add(uint8_t(field.index()));
+      std::visit([this](auto& alt) { add(alt); }, field);
+    } else if constexpr (has_marshal_method<T>::value) {
+      field.marshal(*this);
+    } else if constexpr (std::is_trivially_copyable<T>::value) {
+      bytes.append(reinterpret_cast<const char*>(&field), sizeof(T));
+    } else {
+      add(uint32_t(field.size()));
+      for (auto& item : field)
+        add(item);
+    }
+  }
+};
+
+class ResponseCache {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using EntryPtr = std::shared_ptr<const EncodedFrame>;
+
+  // holds about `capacity` responses in total
+  explicit ResponseCache(size_t capacity, size_t shards = 16)
+      : shards_(shards), shard_capacity_{(capacity + shards - 1) / shards} {}
+
+  // the cached response for `req`, or nullptr
+  template <typename RequestT>
+  EntryPtr find(const RequestT& req, Clock::time_point now = Clock::now()) {
+    auto& key = build_key(req);
+    auto& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock{shard.mutex};
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+      ++misses_;
+      return nullptr;
+    }
+    auto node = it->second;
+    if (now >= node->expires) {
+      shard.index.erase(it);
+      shard.lru.erase(node);
+      ++misses_;
+      return nullptr;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, node);
+    ++hits_;
+    return node->entry;
+  }
+
+  // encodes `resp` with `opts`, caches it as the answer to
+  // `req` for resp.cache_ttl() seconds, and returns it
+  template <typename RequestT, typename ResponseT>
+  EntryPtr insert(const RequestT& req, const ResponseT& resp,
+                  const FrameOptions& opts = {},
+                  Clock::time_point now = Clock::now()) {
+    auto encoded = std::make_shared<EncodedFrame>();
+    encode_payload(resp, opts, encoded->header, encoded->payload);
+    uint32_t ttl = resp.cache_ttl();
+    if (ttl == 0 || shard_capacity_ == 0)
+      return encoded;
+
+    auto& key = build_key(req);
+    auto& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock{shard.mutex};
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      shard.lru.erase(it->second);
+      shard.index.erase(it);
+    }
+    shard.lru.push_front(Node{key, encoded, now + std::chrono::seconds{ttl}});
+    shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+    if (shard.lru.size() > shard_capacity_) {
+      shard.index.erase(shard.lru.back().key);
+      shard.lru.pop_back();
+    }
+    return encoded;
+  }
+
+  size_t size() const {
+    size_t n = 0;
+    for (auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock{shard.mutex};
+      n += shard.lru.size();
+    }
+    return n;
+  }
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+
+ private:
+  struct Node {
+    std::string key;
+    EntryPtr entry;
+    Clock::time_point expires;
+  };
+  struct Shard {
+    mutable std::mutex mutex;
+    std::list<Node> lru;  // most recently used first
+    // keyed by a view of the node's own key
+    std::unordered_map<std::string_view, std::list<Node>::iterator> index;
+  };
+
+  // the key is built in a per-thread buffer, so a lookup
+  // doesn't allocate
+  template <typename RequestT>
+  static const std::string& build_key(const RequestT& req) {
+    static thread_local CacheKeyBuilder builder;
+    builder.bytes.clear();
+    req.cache_key(builder);
+    return builder.bytes;
+  }
+
+  Shard& shard_for(std::string_view key) {
+    // the high bits, as the shard's map uses the low ones
+    size_t hash = std::hash<std::string_view>{}(key);
+    return shards_[(hash >> 32) % shards_.size()];
+  }
+
+ private:
+  std::vector<Shard> shards_;
+  size_t shard_capacity_;
+  std::atomic<size_t> hits_{0};
+  std::atomic<size_t> misses_{0};
+};
+
+}  // namespace rpc
+}  // namespace darr
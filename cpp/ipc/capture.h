@@ -0,0 +1,196 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#include "marshalling.h"
+
+//
+// An append-only log of marshalled items, for recording
+// traffic and replaying it later.  The file is nothing but
+// Stream frames back to back, the same bytes that go over
+// the wire, so anything that can cut a Stream into frames
+// can read it.
+//
+//     CaptureWriter out{"requests.cap"};
+//     out.append(req);
+//
+//     CaptureReader in{"requests.cap"};
+//     SomeRequest req;
+//     while (in.next(req)) { ... }
+//
+// Both ends go through mmap.  The writer grows the file a
+// segment at a time and trims it to what was written when
+// it's closed.  A writer that dies first leaves the rest of
+// the segment zeroed, so the reader takes a zero header as
+// the end of the capture.
+//
+
+namespace darr {
+namespace capture {
+
+namespace detail {
+inline void check(bool ok, const char* what) {
+  if (!ok)
+    throw std::system_error(errno, std::generic_category(), what);
+}
+}  // namespace detail
+
+class CaptureWriter {
+ public:
+  // the file grows by this much at a time; a multiple of the page size
+  static constexpr size_t SEGMENT_SIZE = 16 << 20;
+
+  explicit CaptureWriter(const std::string& path) {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    detail::check(fd_ >= 0, "open");
+  }
+  CaptureWriter(const CaptureWriter&) = delete;
+  ~CaptureWriter() {
+    unmap();
+    if (fd_ >= 0) {
+      (void)::ftruncate(fd_, size_);
+      ::close(fd_);
+    }
+  }
+
+  template <typename Item>
+  void append(const Item& item) {
+    using marshalling::Stream;
+    size_t len = marshalling::byte_size(item);
+    if (len > ~Stream::MASK)
+      throw std::length_error("item too large for one frame");
+    uint8_t* out = reserve(Stream::HEADER_SIZE + len);
+    uint32_t header = Stream::TAG | uint32_t(len);
+    std::memcpy(out, &header, sizeof(header));
+    marshalling::write_item(out + Stream::HEADER_SIZE, len, item);
+    size_ += Stream::HEADER_SIZE + len;
+  }
+
+  // appends an item which is already marshalled
+  void append_bytes(const uint8_t* payload, size_t len) {
+    using marshalling::Stream;
+    if (len > ~Stream::MASK)
+      throw std::length_error("payload too large for one frame");
+    uint8_t* out = reserve(Stream::HEADER_SIZE + len);
+    uint32_t header = Stream::TAG | uint32_t(len);
+    std::memcpy(out, &header, sizeof(header));
+    std::memcpy(out + Stream::HEADER_SIZE, payload, len);
+    size_ += Stream::HEADER_SIZE + len;
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  // makes room for `len` more bytes, remapping a larger file if needed
+  uint8_t* reserve(size_t len) {
+    if (size_ + len > capacity_) {
+      unmap();
+      while (size_ + len > capacity_)
+        capacity_ += SEGMENT_SIZE;
+      detail::check(::ftruncate(fd_, capacity_) == 0, "ftruncate");
+      void* p = ::mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd_, 0);
+      detail::check(p != MAP_FAILED, "mmap");
+      map_ = static_cast<uint8_t*>(p);
+    }
+    return map_ + size_;
+  }
+
+  void unmap() {
+    if (map_)
+      ::munmap(map_, capacity_);
+    map_ = nullptr;
+  }
+
+ private:
+  int fd_{-1};
+  uint8_t* map_{nullptr};
+  size_t size_{0};
+  size_t capacity_{0};
+};
+
+class CaptureReader {
+ public:
+  explicit CaptureReader(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    detail::check(fd >= 0, "open");
+    struct stat st;
+    bool ok = ::fstat(fd, &st) == 0;
+    if (ok && st.st_size > 0) {
+      size_ = st.st_size;
+      void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      ok = p != MAP_FAILED;
+      map_ = ok ? static_cast<uint8_t*>(p) : nullptr;
+    }
+    ::close(fd);
+    detail::check(ok, "mmap");
+    // mmap hands us whole pages; tell the kernel we read them in order
+    if (map_) {
+      ::madvise(map_, size_, MADV_SEQUENTIAL);
+      ::madvise(map_, size_, MADV_WILLNEED);
+    }
+  }
+  CaptureReader(const CaptureReader&) = delete;
+  ~CaptureReader() {
+    if (map_)
+      ::munmap(map_, size_);
+  }
+
+  // the next frame's payload; false at the end of the capture
+  bool next(const uint8_t*& payload, size_t& len) {
+    using marshalling::Stream;
+    const uint8_t* data = map_ + cursor_;
+    size_t avail = size_ - cursor_;
+    if (avail == 0 || zero_fill(data, avail))
+      return false;
+    if (Stream::remaining_bytes(data, avail) != 0)
+      throw std::out_of_range("truncated capture");
+    size_t frame = Stream::frame_size(data, avail);
+    payload = data + Stream::HEADER_SIZE;
+    len = frame - Stream::HEADER_SIZE;
+    cursor_ += frame;
+    return true;
+  }
+
+  template <typename Item>
+  bool next(Item& item) {
+    const uint8_t* payload;
+    size_t len;
+    if (!next(payload, len))
+      return false;
+    marshalling::read_item(payload, len, item);
+    return true;
+  }
+
+  // the whole capture, as Stream frames
+  const uint8_t* data() const { return map_; }
+  size_t size() const { return size_; }
+
+  void rewind() { cursor_ = 0; }
+
+ private:
+  // true if the next header is all zero: the untrimmed end of
+  // a segment, from a writer that didn't close
+  static bool zero_fill(const uint8_t* data, size_t avail) {
+    size_t n = std::min(avail, marshalling::Stream::HEADER_SIZE);
+    for (size_t i = 0; i < n; ++i)
+      if (data[i] != 0)
+        return false;
+    return true;
+  }
+
+  uint8_t* map_{nullptr};
+  size_t size_{0};
+  size_t cursor_{0};
+};
+
+}  // namespace capture
+}  // namespace darr
@@ -0,0 +1,469 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "api.h"
+
+//
+// Longest-prefix-match from an IPAddress to a location record,
+// built for filling SomeRequest::Location on every query.
+//
+//     geo::Builder b;
+//     auto seattle = b.add_record({...});
+//     b.add_prefix(addr, 24, seattle);
+//     geo::Table table = b.build();
+//
+//     if (auto* rec = table.find(req.location.ip_address))
+//       geo::fill(req.location, *rec);
+//
+// Each address family is a poptrie: a direct-indexed table for
+// the first 16 bits, then nodes of 64-way fan out.  A node
+// stores two bitmaps instead of 64 pointers
+//
+//     vector    which of the 64 slots are child nodes
+//     leafvec   where a new run of leaf values starts
+//
+// and finds a child or leaf with a popcount, so nodes are 24
+// bytes and an IPv4 lookup is the direct table plus at most
+// three nodes.  Runs of slots with the same answer share one
+// leaf.  See Asai & Ohara, "Poptrie", SIGCOMM 2015.
+//
+// Tables are one flat block of memory in the same format in
+// RAM and on disk, so a saved snapshot is loaded with mmap and
+// used in place.
+//
+
+namespace darr {
+namespace geo {
+
+// a compact copy of what SomeRequest::Location needs
+struct Record {
+  uint32_t market, country, region, state, asn;
+  char market_iso[4], country_iso[4];
+  char region_code[8], state_code[8];
+};
+
+template <typename LocationT>
+void fill(LocationT& loc, const Record& rec) {
+  auto str = [](const char* s, size_t max) {
+    return std::string_view{s, strnlen(s, max)};
+  };
+  loc.market = rec.market;
+  loc.country = rec.country;
+  loc.region = rec.region;
+  loc.state = rec.state;
+  loc.asn = rec.asn;
+  if (rec.market_iso[0])
+    loc.market_iso = str(rec.market_iso, sizeof(rec.market_iso));
+  if (rec.country_iso[0])
+    loc.country_iso = str(rec.country_iso, sizeof(rec.country_iso));
+  if (rec.region_code[0])
+    loc.region_code = str(rec.region_code, sizeof(rec.region_code));
+  if (rec.state_code[0])
+    loc.state_code = str(rec.state_code, sizeof(rec.state_code));
+}
+
+namespace detail {
+enum : uint32_t {
+  DIRECT_BITS = 16,
+  STRIDE = 6,
+  LEAF = 0x80000000,  // marks a direct entry which is a leaf
+  NONE = 0x7FFFFFFF,  // a leaf with no record
+};
+
+// addresses are left aligned in a key, so the first bit of the
+// address is the top bit of the key
+using Key4 = uint64_t;
+using Key6 = unsigned __int128;
+
+inline Key4 key_of(const IPAddress::ipv4_type& a) {
+  Key4 k = 0;
+  for (auto b : a)
+    k = (k << 8) | b;
+  return k << 32;
+}
+inline Key6 key_of(const IPAddress::ipv6_type& a) {
+  Key6 k = 0;
+  for (auto b : a)
+    k = (k << 8) | b;
+  return k;
+}
+
+template <typename KeyT>
+constexpr unsigned key_bits() {
+  return sizeof(KeyT) * 8;
+}
+// the `bits` bits of the key starting at `depth`
+template <typename KeyT>
+uint32_t bits_at(KeyT key, unsigned depth, unsigned bits) {
+  return uint32_t((key << depth) >> (key_bits<KeyT>() - bits));
+}
+template <typename KeyT>
+KeyT prefix_mask(unsigned len) {
+  return len == 0 ? 0 : ~KeyT(0) << (key_bits<KeyT>() - len);
+}
+
+inline uint64_t below(uint32_t slot) { return (uint64_t(2) << slot) - 1; }
+
+struct Node {
+  uint64_t vector;
+  uint64_t leafvec;
+  uint32_t base0;  // our first leaf
+  uint32_t base1;  // our first child node
+};
+
+// a view of one address family's trie
+template <typename KeyT>
+struct Trie {
+  const uint32_t* direct;
+  const Node* nodes;
+  const uint32_t* leaves;
+
+  uint32_t find(KeyT key) const {
+    uint32_t d = direct[bits_at(key, 0, DIRECT_BITS)];
+    if (d & LEAF)
+      return d & ~LEAF;
+    const Node* node = &nodes[d];
+    for (unsigned depth = DIRECT_BITS;; depth += STRIDE) {
+      uint32_t slot = bits_at(key, depth, STRIDE);
+      if ((node->vector >> slot) & 1) {
+        node = &nodes[node->base1 + __builtin_popcountll(
+                                        node->vector & below(slot)) -
+                      1];
+      } else {
+        return leaves[node->base0 +
+                      __builtin_popcountll(node->leafvec & below(slot)) - 1];
+      }
+    }
+  }
+};
+
+// builds one family's trie from a list of prefixes
+template <typename KeyT>
+class TrieBuilder {
+ public:
+  struct Entry {
+    KeyT key;
+    uint32_t record;
+    uint8_t len;
+  };
+
+  std::vector<uint32_t> direct;
+  std::vector<Node> nodes;
+  std::vector<uint32_t> leaves;
+
+  void build(std::vector<Entry>& entries) {
+    // sort by key then length, and let the last duplicate win
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const Entry& a, const Entry& b) {
+                       return a.key < b.key ||
+                              (a.key == b.key && a.len < b.len);
+                     });
+    auto same = [](const Entry& a, const Entry& b) {
+      return a.key == b.key && a.len == b.len;
+    };
+    auto out = entries.begin();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+      if (out != entries.begin() && same(*(out - 1), *it))
+        *(out - 1) = *it;
+      else
+        *out++ = *it;
+    }
+    entries.erase(out, entries.end());
+
+    direct.assign(size_t(1) << DIRECT_BITS, LEAF | NONE);
+    auto first_long = std::stable_partition(
+        entries.begin(), entries.end(),
+        [](const Entry& e) { return e.len <= DIRECT_BITS; });
+    expand(entries.begin(), first_long, 0, DIRECT_BITS, direct.data(),
+           LEAF);
+
+    // the rest hang off of nodes, one per direct slot they fall in
+    for (auto it = first_long; it != entries.end();) {
+      uint32_t slot = bits_at(it->key, 0, DIRECT_BITS);
+      auto end = std::find_if(it, entries.end(), [&](const Entry& e) {
+        return bits_at(e.key, 0, DIRECT_BITS) != slot;
+      });
+      uint32_t node = nodes.size();
+      nodes.emplace_back();
+      build_node(node, it, end, DIRECT_BITS, direct[slot] & ~LEAF);
+      direct[slot] = node;
+      it = end;
+    }
+  }
+
+ private:
+  using Iter = typename std::vector<Entry>::iterator;
+
+  // writes the records of prefixes no longer than depth + bits into
+  // the `bits` wide slot table, shorter prefixes first so longer
+  // ones win
+  static void expand(Iter begin, Iter end, unsigned depth, unsigned bits,
+                     uint32_t* slots, uint32_t flag) {
+    std::stable_sort(begin, end, [](const Entry& a, const Entry& b) {
+      return a.len < b.len;
+    });
+    for (auto it = begin; it != end; ++it) {
+      uint32_t first = bits_at(it->key, depth, bits);
+      uint32_t count = uint32_t(1) << (depth + bits - it->len);
+      std::fill(slots + first, slots + first + count, it->record | flag);
+    }
+  }
+
+  void build_node(uint32_t index, Iter begin, Iter end, unsigned depth,
+                  uint32_t inherited) {
+    uint32_t values[64];
+    std::fill(std::begin(values), std::end(values), inherited);
+    auto first_long = std::stable_partition(begin, end, [&](const Entry& e) {
+      return e.len <= depth + STRIDE;
+    });
+    expand(begin, first_long, depth, STRIDE, values, 0);
+
+    // group the longer prefixes by slot; each group is a child
+    struct Group {
+      uint32_t slot;
+      Iter begin, end;
+    };
+    std::vector<Group> groups;
+    Node node{};
+    for (auto it = first_long; it != end;) {
+      uint32_t slot = bits_at(it->key, depth, STRIDE);
+      auto group_end = std::find_if(it, end, [&](const Entry& e) {
+        return bits_at(e.key, depth, STRIDE) != slot;
+      });
+      groups.push_back({slot, it, group_end});
+      node.vector |= uint64_t(1) << slot;
+      it = group_end;
+    }
+
+    // the remaining slots are leaves; runs of one value share one
+    node.base0 = leaves.size();
+    bool first = true;
+    for (uint32_t slot = 0; slot < 64; ++slot) {
+      if ((node.vector >> slot) & 1)
+        continue;
+      if (first || values[slot] != leaves.back()) {
+        node.leafvec |= uint64_t(1) << slot;
+        leaves.push_back(values[slot]);
+      }
+      first = false;
+    }
+
+    // children are allocated as a block so they can be found by rank
+    node.base1 = nodes.size();
+    nodes.resize(nodes.size() + groups.size());
+    nodes[index] = node;
+    for (size_t i = 0; i < groups.size(); ++i) {
+      build_node(node.base1 + i, groups[i].begin, groups[i].end,
+                 depth + STRIDE, values[groups[i].slot]);
+    }
+  }
+};
+
+// --- the block format, shared by memory and disk ---
+
+struct Header {
+  char magic[8];
+  uint64_t direct4, nodes4, leaves4;
+  uint64_t direct6, nodes6, leaves6;
+  uint64_t records;
+};
+constexpr char MAGIC[8] = {'d', 'a', 'r', 'r', 'g', 'e', 'o', '1'};
+
+inline size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+// calls fn(offset, bytes) for each array in the block, in order
+template <typename Fn>
+void for_each_array(const Header& h, Fn&& fn) {
+  size_t off = sizeof(Header);
+  size_t sizes[] = {h.direct4 * sizeof(uint32_t), h.nodes4 * sizeof(Node),
+                    h.leaves4 * sizeof(uint32_t), h.direct6 * sizeof(uint32_t),
+                    h.nodes6 * sizeof(Node),      h.leaves6 * sizeof(uint32_t),
+                    h.records * sizeof(Record)};
+  for (size_t i = 0; i < 7; ++i) {
+    fn(i, off, sizes[i]);
+    off = align8(off + sizes[i]);
+  }
+}
+}  // namespace detail
+
+class Table {
+ public:
+  Table() = default;
+  Table(Table&& o) { *this = std::move(o); }
+  Table& operator=(Table&& o) {
+    std::swap(block_, o.block_);
+    std::swap(map_, o.map_);
+    std::swap(map_size_, o.map_size_);
+    std::swap(v4_, o.v4_);
+    std::swap(v6_, o.v6_);
+    std::swap(records_, o.records_);
+    std::swap(record_count_, o.record_count_);
+    return *this;
+  }
+  Table(const Table&) = delete;
+  ~Table() {
+    if (map_)
+      ::munmap(map_, map_size_);
+  }
+
+  // the record for the longest matching prefix, or nullptr
+  const Record* find(const IPAddress& addr) const {
+    if (!records_)
+      return nullptr;
+    uint32_t rec;
+    if (auto* v4 = std::get_if<IPAddress::ipv4_type>(&addr.data))
+      rec = v4_.find(detail::key_of(*v4));
+    else
+      rec = v6_.find(detail::key_of(std::get<IPAddress::ipv6_type>(addr.data)));
+    return rec == detail::NONE ? nullptr : &records_[rec];
+  }
+
+  // the whole table as one block, as written by save()
+  const uint8_t* data() const { return map_ ? map_ : block_.data(); }
+  size_t size() const { return map_ ? map_size_ : block_.size(); }
+
+  void save(const std::string& path) const {
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    out.write(reinterpret_cast<const char*>(data()), size());
+    if (!out)
+      throw std::system_error(errno, std::generic_category(), path);
+  }
+
+  // maps a snapshot written by save(); it's used in place
+  static Table load(const std::string& path) {
+    Table t;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), path);
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0)
+      p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      throw std::system_error(errno, std::generic_category(), path);
+    t.map_ = static_cast<uint8_t*>(p);
+    t.map_size_ = st.st_size;
+    t.attach();
+    return t;
+  }
+
+ private:
+  friend class Builder;
+
+  // points our views at the arrays in the block
+  void attach() {
+    using detail::Header;
+    const uint8_t* base = data();
+    Header h;
+    if (size() < sizeof(h))
+      throw std::out_of_range("geo table too small");
+    std::memcpy(&h, base, sizeof(h));
+    if (std::memcmp(h.magic, detail::MAGIC, sizeof(h.magic)) != 0)
+      throw std::out_of_range("not a geo table");
+
+    const void* arrays[7];
+    size_t end = 0;
+    detail::for_each_array(h, [&](size_t i, size_t off, size_t bytes) {
+      arrays[i] = base + off;
+      end = off + bytes;
+    });
+    if (end > size())
+      throw std::out_of_range("truncated geo table");
+    v4_ = {static_cast<const uint32_t*>(arrays[0]),
+           static_cast<const detail::Node*>(arrays[1]),
+           static_cast<const uint32_t*>(arrays[2])};
+    v6_ = {static_cast<const uint32_t*>(arrays[3]),
+           static_cast<const detail::Node*>(arrays[4]),
+           static_cast<const uint32_t*>(arrays[5])};
+    records_ = static_cast<const Record*>(arrays[6]);
+    record_count_ = h.records;
+  }
+
+ private:
+  std::vector<uint8_t> block_;
+  uint8_t* map_{nullptr};
+  size_t map_size_{0};
+  detail::Trie<detail::Key4> v4_{};
+  detail::Trie<detail::Key6> v6_{};
+  const Record* records_{nullptr};
+  size_t record_count_{0};
+};
+
+// Bulk loader; add everything then build() once
+class Builder {
+ public:
+  uint32_t add_record(const Record& rec) {
+    records_.push_back(rec);
+    return records_.size() - 1;
+  }
+
+  void add_prefix(const IPAddress& addr, uint8_t len, uint32_t record) {
+    if (record >= records_.size())
+      throw std::out_of_range("unknown geo record");
+    if (auto* v4 = std::get_if<IPAddress::ipv4_type>(&addr.data)) {
+      if (len > 32)
+        throw std::out_of_range("bad IPv4 prefix length");
+      auto key = detail::key_of(*v4) & detail::prefix_mask<detail::Key4>(len);
+      v4_.push_back({key, record, len});
+    } else {
+      if (len > 128)
+        throw std::out_of_range("bad IPv6 prefix length");
+      auto key = detail::key_of(std::get<IPAddress::ipv6_type>(addr.data)) &
+                 detail::prefix_mask<detail::Key6>(len);
+      v6_.push_back({key, record, len});
+    }
+  }
+
+  Table build() {
+    detail::TrieBuilder<detail::Key4> t4;
+    detail::TrieBuilder<detail::Key6> t6;
+    t4.build(v4_);
+    t6.build(v6_);
+
+    detail::Header h{};
+    std::memcpy(h.magic, detail::MAGIC, sizeof(h.magic));
+    h.direct4 = t4.direct.size();
+    h.nodes4 = t4.nodes.size();
+    h.leaves4 = t4.leaves.size();
+    h.direct6 = t6.direct.size();
+    h.nodes6 = t6.nodes.size();
+    h.leaves6 = t6.leaves.size();
+    h.records = records_.size();
+
+    const void* arrays[] = {t4.direct.data(), t4.nodes.data(),
+                            t4.leaves.data(), t6.direct.data(),
+                            t6.nodes.data(),  t6.leaves.data(),
+                            records_.data()};
+    Table t;
+    detail::for_each_array(h, [&](size_t i, size_t off, size_t bytes) {
+      t.block_.resize(detail::align8(off + bytes));
+      if (bytes)
+        std::memcpy(t.block_.data() + off, arrays[i], bytes);
+    });
+    std::memcpy(t.block_.data(), &h, sizeof(h));
+    t.attach();
+    return t;
+  }
+
+ private:
+  std::vector<Record> records_;
+  std::vector<detail::TrieBuilder<detail::Key4>::Entry> v4_;
+  std::vector<detail::TrieBuilder<detail::Key6>::Entry> v6_;
+};
+
+}  // namespace geo
+}  // namespace darr
@@ -0,0 +1,119 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "geo.h"
+
+//
+// Builds a geo::Table from synthetic prefixes and times it.
+//
+//     geo_bench [PREFIXES]
+//
+// PREFIXES defaults to five million IPv4 prefixes, with a
+// tenth as many IPv6 ones on top.  IPv4 lengths lean toward
+// /24, as in a real routing table.
+//
+
+namespace darr {
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+IPAddress v4(uint32_t ip) {
+  return {IPAddress::ipv4_type{uint8_t(ip >> 24), uint8_t(ip >> 16),
+                               uint8_t(ip >> 8), uint8_t(ip)}};
+}
+
+IPAddress v6(uint64_t hi) {
+  IPAddress::ipv6_type a{};
+  for (int i = 0; i < 8; ++i)
+    a[i] = uint8_t(hi >> (56 - 8 * i));
+  return {a};
+}
+
+// ns per lookup over `addrs`; `sink` keeps the loop honest
+double time_lookups(const geo::Table& table,
+                    const std::vector<IPAddress>& addrs, uint64_t& sink) {
+  auto start = Clock::now();
+  for (auto& addr : addrs)
+    if (auto* rec = table.find(addr))
+      sink += rec->asn;
+  return seconds_since(start) * 1e9 / addrs.size();
+}
+
+int run(size_t count) {
+  std::mt19937_64 rng{1};
+  std::discrete_distribution<int> v4_len{
+      {1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 3, 4, 4, 4, 5, 5, 60, 2, 1, 1, 1, 1, 1, 1}};
+
+  auto start = Clock::now();
+  geo::Builder builder;
+  for (uint32_t i = 0; i < 50000; ++i) {
+    geo::Record rec{};
+    rec.market = i % 400;
+    rec.country = i % 200;
+    rec.asn = i;
+    builder.add_record(rec);
+  }
+  std::vector<uint32_t> v4_nets;
+  std::vector<uint64_t> v6_nets;
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t net = rng();
+    v4_nets.push_back(net);
+    builder.add_prefix(v4(net), 8 + v4_len(rng), rng() % 50000);
+  }
+  for (size_t i = 0; i < count / 10; ++i) {
+    uint64_t net = (uint64_t(0x2000) << 48) | (rng() >> 16);
+    v6_nets.push_back(net);
+    builder.add_prefix(v6(net), 32 + rng() % 33, rng() % 50000);
+  }
+  double gen_secs = seconds_since(start);
+
+  start = Clock::now();
+  geo::Table table = builder.build();
+  double build_secs = seconds_since(start);
+
+  // lookups land inside the prefixes, in random order
+  std::vector<IPAddress> v4_addrs, v6_addrs;
+  for (size_t i = 0; i < 10000000; ++i)
+    v4_addrs.push_back(v4(v4_nets[rng() % v4_nets.size()] ^ (rng() & 0xFF)));
+  for (size_t i = 0; i < 1000000; ++i)
+    v6_addrs.push_back(v6(v6_nets[rng() % v6_nets.size()] ^ (rng() & 0xFF)));
+
+  uint64_t sink = 0;
+  double v4_ns = time_lookups(table, v4_addrs, sink);
+  double v6_ns = time_lookups(table, v6_addrs, sink);
+
+  std::string path = "/tmp/geo_bench." + std::to_string(getpid());
+  table.save(path);
+  start = Clock::now();
+  geo::Table loaded = geo::Table::load(path);
+  double load_secs = seconds_since(start);
+  double loaded_ns = time_lookups(loaded, v4_addrs, sink);
+  unlink(path.c_str());
+
+  std::cout << "prefixes:     " << count << " v4, " << count / 10 << " v6\n"
+            << "generate:     " << gen_secs << " s\n"
+            << "build:        " << build_secs << " s\n"
+            << "table size:   " << table.size() / (1 << 20) << " MiB\n"
+            << "v4 lookup:    " << v4_ns << " ns\n"
+            << "v6 lookup:    " << v6_ns << " ns\n"
+            << "mmap load:    " << load_secs << " s\n"
+            << "v4 (mmapped): " << loaded_ns << " ns\n"
+            << "(" << sink << ")\n";
+  return 0;
+}
+}  // namespace
+}  // namespace darr
+
+int main(int argc, char** argv) {
+  size_t count = argc > 1 ? std::stoul(argv[1]) : 5000000;
+  return darr::run(count);
+}
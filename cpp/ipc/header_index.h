@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+//
+// A small open-addressing table over a message's headers,
+// keyed on a case-insensitive hash of the name, so looking
+// up a header doesn't mean a compare against every one.
+//
+//     HeaderIndex index;
+//     index.build(req.headers);
+//     auto* vary = index.find(req.headers, "vary");
+//
+// Headers past the first MAX_INDEXED, or added after build(),
+// are still found, by a linear scan.  Entries for headers
+// dropped since build() are skipped, so shrinking the list is
+// safe; rewriting it in place needs another build().
+//
+
+namespace darr {
+
+namespace detail {
+constexpr uint64_t ONES = 0x0101010101010101ull;
+
+// lower cases the ASCII letters in a word, a byte per lane
+inline uint64_t swar_lower(uint64_t x) {
+  uint64_t low7 = x & (0x7F * ONES);
+  uint64_t ge_a = low7 + (0x80 - 'A') * ONES;      // top bit set if >= 'A'
+  uint64_t gt_z = low7 + (0x80 - 'Z' - 1) * ONES;  // top bit set if > 'Z'
+  uint64_t upper = ge_a & ~gt_z & ~x & (0x80 * ONES);
+  return x | (upper >> 2);  // 0x80 >> 2 is the case bit
+}
+
+inline char ascii_lower(char c) {
+  return (c >= 'A' && c <= 'Z') ? char(c | 0x20) : c;
+}
+}  // namespace detail
+
+// a case-insensitive hash of a header name, eight bytes at a time
+inline uint32_t header_hash(std::string_view name) {
+  uint64_t h = name.size() * 0x9E3779B97F4A7C15ull;
+  const char* p = name.data();
+  size_t n = name.size();
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t word;
+    std::memcpy(&word, p, 8);
+    h = (h ^ detail::swar_lower(word)) * 0xFF51AFD7ED558CCDull;
+    h ^= h >> 32;
+  }
+  if (n) {
+    uint64_t word = 0;
+    std::memcpy(&word, p, n);
+    h = (h ^ detail::swar_lower(word)) * 0xFF51AFD7ED558CCDull;
+    h ^= h >> 32;
+  }
+  return uint32_t(h);
+}
+
+inline bool header_name_equal(const char* a, std::string_view b) {
+  size_t i = 0;
+  for (; i < b.size(); ++i)
+    if (a[i] == '\0' || detail::ascii_lower(a[i]) != detail::ascii_lower(b[i]))
+      return false;
+  return a[i] == '\0';
+}
+
+class HeaderIndex {
+ public:
+  static constexpr size_t SLOTS = 64;  // a power of two
+  static constexpr size_t MAX_INDEXED = SLOTS / 2;
+
+  template <typename Headers>
+  void build(const Headers& headers) {
+    std::memset(slots_, 0, sizeof(slots_));
+    count_ = headers.size() < MAX_INDEXED ? headers.size() : MAX_INDEXED;
+    for (size_t i = 0; i < count_; ++i) {
+      uint32_t hash = header_hash(*headers[i].name);
+      size_t slot = hash & (SLOTS - 1);
+      while (slots_[slot])
+        slot = (slot + 1) & (SLOTS - 1);
+      hashes_[slot] = hash;
+      slots_[slot] = uint8_t(i + 1);
+    }
+  }
+
+  // the first header named `name`, ignoring case, or nullptr
+  template <typename Headers>
+  auto find(const Headers& headers, std::string_view name) const
+      -> decltype(&headers[0]) {
+    // the first match by position wins, as with a scan
+    uint32_t hash = header_hash(name);
+    size_t best = SLOTS;
+    for (size_t slot = hash & (SLOTS - 1); slots_[slot];
+         slot = (slot + 1) & (SLOTS - 1)) {
+      size_t i = slots_[slot] - 1;
+      if (hashes_[slot] == hash && i < best && i < headers.size() &&
+          header_name_equal(*headers[i].name, name))
+        best = i;
+    }
+    if (best < SLOTS)
+      return &headers[best];
+    for (size_t i = count_; i < headers.size(); ++i)
+      if (header_name_equal(*headers[i].name, name))
+        return &headers[i];
+    return nullptr;
+  }
+
+ private:
+  uint32_t hashes_[SLOTS];
+  uint8_t slots_[SLOTS]{};  // index + 1 into the headers; 0 is empty
+  size_t count_{0};         // how many headers are indexed
+};
+
+}  // namespace darr
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+//
+// A fixed-size latency histogram with log-linear buckets:
+// each power of two is split into SUB_BUCKETS, so any value
+// is recorded to within 1/16th, from a nanosecond to years,
+// in a few KB that can be merged across threads.
+//
+//     Histogram h;
+//     h.record(ns);
+//     h.percentile(99.9);
+//
+
+namespace darr {
+
+class Histogram {
+ public:
+  static constexpr int SUB_BITS = 4;
+  static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+  static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+  void record(uint64_t value, uint64_t times = 1) {
+    counts_[bucket(value)] += times;
+    count_ += times;
+    sum_ += value * times;
+    max_ = std::max(max_, value);
+    min_ = std::min(min_, value);
+  }
+
+  void merge(const Histogram& other) {
+    for (int i = 0; i < BUCKETS; ++i)
+      counts_[i] += other.counts_[i];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+    min_ = std::min(min_, other.min_);
+  }
+
+  void clear() { *this = Histogram{}; }
+
+  // the smallest recorded value that `p` percent are at or under,
+  // to the precision of its bucket
+  uint64_t percentile(double p) const {
+    if (count_ == 0)
+      return 0;
+    uint64_t rank = uint64_t(p / 100 * count_ + 0.5);
+    rank = std::max<uint64_t>(1, std::min(rank, count_));
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+      seen += counts_[i];
+      if (seen >= rank)
+        return std::min(std::max(upper_bound(i), min_), max_);
+    }
+    return max_;
+  }
+
+  // how many values are at or under `value`, to bucket precision
+  uint64_t count_at_or_under(uint64_t value) const {
+    uint64_t n = 0;
+    for (int i = 0, last = bucket(value); i <= last; ++i)
+      n += counts_[i];
+    return n;
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t max() const { return max_; }
+  uint64_t min() const { return count_ ? min_ : 0; }
+  double mean() const { return count_ ? double(sum_) / count_ : 0; }
+
+  // walks the non-empty buckets as fn(upper bound, count)
+  template <typename Fn>
+  void for_each_bucket(Fn&& fn) const {
+    for (int i = 0; i < BUCKETS; ++i)
+      if (counts_[i])
+        fn(upper_bound(i), counts_[i]);
+  }
+
+ private:
+  // values under SUB_BUCKETS get a bucket each; after that the
+  // top SUB_BITS + 1 bits pick it
+  static int bucket(uint64_t value) {
+    if (value < SUB_BUCKETS)
+      return int(value);
+    int top = 63 - __builtin_clzll(value);  // >= SUB_BITS
+    int shift = top - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + int((value >> shift) - SUB_BUCKETS);
+  }
+  static uint64_t upper_bound(int i) {
+    if (i < SUB_BUCKETS)
+      return uint64_t(i);
+    int shift = i / SUB_BUCKETS - 1;
+    uint64_t base = uint64_t(SUB_BUCKETS + i % SUB_BUCKETS) << shift;
+    return base + ((uint64_t(1) << shift) - 1);
+  }
+
+ private:
+  std::array<uint64_t, BUCKETS> counts_{};
+  uint64_t count_{0};
+  uint64_t sum_{0};
+  uint64_t max_{0};
+  uint64_t min_{UINT64_MAX};
+};
+
+}  // namespace darr
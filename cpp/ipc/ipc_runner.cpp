@@ -1,8 +1,28 @@
 #include "api.h"
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <random>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "cache.h"
+#include "geo.h"
+#include "histogram.h"
+#include "loadgen.h"
+#include "rpc.h"
+#include "scoring.h"
+#include "shard_server.h"
+
 namespace darr {
 
 // we use `a` and `b` here b/c both EXPECT_EQ(expected, actual)
@@ -16,7 +36,866 @@ void expect_eq(T1&& a, T2&& b, const char* a_expr, const char* b_expr) {
 }
 #define EXPECT_EQ(a, b) expect_eq(a, b, #a, #b);
 
+void sparse_encoding() {
+  std::vector<uint8_t> bytes;
+  {
+    // a default response is two bitmaps (the outer one is for the
+    // object itself) and the string table
+    SomeResponse resp;
+    EXPECT_EQ(marshalling::sparse_byte_size(resp), 5u);
+    EXPECT_EQ(marshalling::byte_size(resp) > 5, true);
+
+    resp.exception = "timeout";
+    resp.answers.emplace_back().answer = "a.example.com";
+    marshalling::write_sparse_item(bytes, resp);
+  }
+  {
+    SomeResponse resp;
+    resp.exec_time_micros = 5;  // absent on the wire, so reset
+    marshalling::read_sparse_item(bytes, resp);
+    EXPECT_EQ(resp.exec_time_micros, 0u);
+    EXPECT_EQ(resp.reason_code, "");
+    EXPECT_EQ(resp.exception, "timeout");
+    EXPECT_EQ(resp.answers.size(), 1u);
+    EXPECT_EQ(resp.answers[0].answer, "a.example.com");
+    EXPECT_EQ(resp.init_response.providers.size(), 0u);
+  }
+}
+
+void pipelined_rpc() {
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  rpc::Client<SomeRequest, SomeResponse> client{fds[0]};
+  rpc::Server<SomeRequest, SomeResponse> server{fds[1]};
+
+  // three calls in flight before the server reads any of them
+  std::vector<std::string> answers;
+  for (auto* method : {"a", "b", "c"}) {
+    SomeRequest req;
+    req.query.method = method;
+    client.call(req, [&](SomeResponse& resp) {
+      answers.emplace_back(*resp.answers[0].answer);
+    });
+  }
+  EXPECT_EQ(client.outstanding(), 3u);
+
+  // the server answers them in reverse order
+  std::vector<std::pair<uint32_t, std::string>> pending;
+  while (pending.size() < 3) {
+    server.serve_batch([&](uint32_t call_id, SomeRequest& req) {
+      pending.emplace_back(call_id, *req.query.method);
+    });
+  }
+  for (auto it = pending.rbegin(); it != pending.rend(); ++it) {
+    SomeResponse resp;
+    resp.answers.emplace_back().answer = it->second;
+    server.respond(it->first, resp);
+  }
+
+  client.drain();
+  EXPECT_EQ(client.outstanding(), 0u);
+  EXPECT_EQ(answers.size(), 3u);
+  EXPECT_EQ(answers[0], "c");
+  EXPECT_EQ(answers[2], "a");
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void lz_codec() {
+  std::string text;
+  for (int i = 0; i < 200; ++i)
+    text += "provider-" + std::to_string(i % 7) + ".example.com;";
+  auto* src = reinterpret_cast<const uint8_t*>(text.data());
+
+  std::vector<uint8_t> packed(lz::compress_bound(text.size()));
+  size_t n = lz::compress(src, text.size(), packed.data(), packed.size());
+  EXPECT_EQ(n > 0 && n < text.size() / 4, true);
+
+  std::string out(text.size(), '\0');
+  auto* dst = reinterpret_cast<uint8_t*>(out.data());
+  EXPECT_EQ(lz::decompress(packed.data(), n, dst, out.size()), true);
+  EXPECT_EQ(out, text);
+  // truncated or mis-sized blocks are rejected
+  EXPECT_EQ(lz::decompress(packed.data(), n / 2, dst, out.size()), false);
+  EXPECT_EQ(lz::decompress(packed.data(), n, dst, out.size() - 1), false);
+}
+
+void compressed_rpc() {
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  rpc::Client<SomeRequest, SomeResponse> client{fds[0]};
+  rpc::Server<SomeRequest, SomeResponse> server{fds[1]};
+  server.set_compression(256);
+
+  client.call(SomeRequest{}, [](SomeResponse& resp) {
+    EXPECT_EQ(resp.reason_log.size(), 100u);
+    EXPECT_EQ(resp.reason_log[99], "skipped provider: over capacity");
+  });
+  server.serve([&](uint32_t call_id, SomeRequest&) {
+    SomeResponse resp;
+    for (int i = 0; i < 100; ++i)
+      resp.reason_log.emplace_back("skipped provider: over capacity");
+    server.respond(call_id, resp);
+  });
+  client.drain();
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void capture_replay() {
+  char path[] = "/tmp/ipc_runner.XXXXXX";
+  close(mkstemp(path));
+  {
+    capture::CaptureWriter out{path};
+    for (auto* prefix : {"/a", "/b", "/c"}) {
+      SomeRequest req;
+      req.query.prefix = prefix;
+      out.append(req);
+    }
+  }
+  {
+    capture::CaptureReader in{path};
+    std::string prefixes;
+    for (SomeRequest req; in.next(req);)
+      prefixes += *req.query.prefix;
+    EXPECT_EQ(prefixes, "/a/b/c");
+  }
+  // as a writer that died would leave it: the segment's zeros
+  EXPECT_EQ(truncate(path, capture::CaptureWriter::SEGMENT_SIZE), 0);
+  {
+    capture::CaptureReader in{path};
+    size_t count = 0;
+    for (SomeRequest req; in.next(req);)
+      ++count;
+    EXPECT_EQ(count, 3u);
+  }
+  unlink(path);
+}
+
+void frame_index() {
+  // a burst of frames, as one big recv would see them
+  std::vector<uint8_t> bytes;
+  for (int i = 0; i < 100; ++i) {
+    SomeRequest req;
+    req.location.asn = i;
+    uint32_t header = marshalling::Stream::TAG | marshalling::byte_size(req);
+    auto* h = reinterpret_cast<uint8_t*>(&header);
+    bytes.insert(bytes.end(), h, h + sizeof(header));
+    marshalling::write_item(bytes, req);
+  }
+  bytes.resize(bytes.size() - 1);  // the last one is partial
+
+  std::vector<marshalling::FrameSpan> spans(128);
+  auto r = marshalling::Stream::index_frames(bytes.data(), bytes.size(),
+                                             spans.data(), spans.size());
+  EXPECT_EQ(r.count, 99u);
+  EXPECT_EQ(r.bad_tag, false);
+  EXPECT_EQ(r.consumed, spans[98].offset + spans[98].size);
+
+  // each thread decodes a share of the frames into its own request
+  std::atomic<uint32_t> asn_sum{0};
+  std::vector<std::thread> pool;
+  for (size_t t = 0; t < 4; ++t) {
+    pool.emplace_back([&, t] {
+      SomeRequest req;
+      for (size_t i = t; i < r.count; i += 4) {
+        auto hdr = marshalling::Stream::HEADER_SIZE;
+        marshalling::read_item(bytes.data() + spans[i].offset + hdr,
+                               spans[i].size - hdr, req);
+        asn_sum += req.location.asn;
+      }
+    });
+  }
+  for (auto& t : pool)
+    t.join();
+  EXPECT_EQ(asn_sum.load(), 99u * 98 / 2);
+
+  bytes[spans[10].offset + 3] = 0xBE;  // corrupt a tag
+  r = marshalling::Stream::index_frames(bytes.data(), bytes.size(),
+                                        spans.data(), spans.size());
+  EXPECT_EQ(r.count, 10u);
+  EXPECT_EQ(r.bad_tag, true);
+}
+
+// trivially copyable, but with bytes marshal() doesn't list
+struct Padded : marshalling::SerializedType<Padded> {
+  uint8_t flags{0};
+  uint32_t market{0};  // after three bytes of padding
+
+  template <typename Archive>
+  void marshal(Archive& ar) const {
+    ar(flags, market, strings_);
+  }
+};
+struct Unlisted : marshalling::SerializedType<Unlisted> {
+  uint64_t market{0};
+  uint64_t cache{0};  // not for the wire
+
+  template <typename Archive>
+  void marshal(Archive& ar) const {
+    ar(market, strings_);
+  }
+};
+
+void direct_image() {
+  EXPECT_EQ(SomeRequest{}.has_direct_image(), false);
+  EXPECT_EQ(Padded{}.has_direct_image(), false);
+  EXPECT_EQ(Unlisted{}.has_direct_image(), false);
+
+  std::vector<uint8_t> bytes;
+  {
+    LookupRequest req;
+    EXPECT_EQ(req.has_direct_image(), true);
+    req.ip_address.data = IPAddress::ipv4_type{10, 0, 0, 1};
+    req.market = 7;
+    req.prefix = "/v1/decide";
+    marshalling::ContainerOutputStream<std::vector<uint8_t>> out{bytes};
+    req.write_direct(out);
+  }
+  {
+    LookupRequest req;
+    req.read_direct(bytes.data(), bytes.size());
+    EXPECT_EQ(req.market, 7u);
+    EXPECT_EQ(req.prefix, "/v1/decide");
+    EXPECT_EQ(req.worker_id, "");
+    EXPECT_EQ(std::get<0>(req.ip_address.data)[3], 1);
+  }
+
+  // a peer can send anything, so a bad image must throw
+  auto rejects = [](auto& req, const std::vector<uint8_t>& image) {
+    bool threw = false;
+    try {
+      req.read_direct(image.data(), image.size());
+    } catch (const std::out_of_range&) {
+      threw = true;
+    }
+    return threw;
+  };
+  {
+    SomeRequest req;  // has containers, so no image at all
+    EXPECT_EQ(rejects(req, bytes), true);
+  }
+  {
+    LookupRequest req;
+    // the image is the end of the object, then the strings
+    size_t strings = sizeof("/v1/decide") + 1;
+    size_t image = bytes.size() - strings;
+    auto at = [&](const void* field) {
+      return reinterpret_cast<const uint8_t*>(field) -
+             reinterpret_cast<const uint8_t*>(&req) - (sizeof(req) - image);
+    };
+    auto bad = bytes;
+    uint16_t past_end = strings;
+    std::memcpy(&bad[at(&req.prefix)], &past_end, sizeof(past_end));
+    EXPECT_EQ(rejects(req, bad), true);
+    EXPECT_EQ(req.prefix, "");
+
+    // find the variant's index, wherever the library keeps it
+    std::variant<IPAddress::ipv4_type, IPAddress::ipv6_type> v6{
+        IPAddress::ipv6_type{}};
+    auto* v6_bytes = reinterpret_cast<const uint8_t*>(&v6);
+    size_t index = std::find(v6_bytes, v6_bytes + sizeof(v6), 1) - v6_bytes;
+    bad = bytes;
+    bad[at(&req.ip_address.data) + index] = 7;
+    EXPECT_EQ(rejects(req, bad), true);
+  }
+
+  // and over rpc, where it's two iovecs after the headers
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  rpc::Client<LookupRequest, SomeResponse> client{fds[0]};
+  rpc::Server<LookupRequest, SomeResponse> server{fds[1]};
+  client.set_direct_image(true);
+  {
+    LookupRequest req;
+    req.worker_id = "w1";
+    client.call(req, [](SomeResponse&) {});
+  }
+  server.serve([&](uint32_t call_id, LookupRequest& req) {
+    EXPECT_EQ(req.worker_id, "w1");
+    server.respond(call_id, SomeResponse{});
+  });
+  client.drain();
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void geo_lookup() {
+  // random prefixes, checked against a brute force longest match
+  std::mt19937 rng{42};
+  geo::Builder builder;
+  struct Prefix {
+    IPAddress::ipv4_type addr;
+    uint8_t len;
+    uint32_t record;
+  };
+  std::vector<Prefix> prefixes;
+  for (uint32_t i = 0; i < 2000; ++i) {
+    geo::Record rec{};
+    rec.asn = i;
+    auto id = builder.add_record(rec);
+    uint32_t bits = rng() & 0x0FFFFFFF;  // keep them crowded together
+    uint8_t len = 1 + rng() % 32;
+    IPAddress::ipv4_type addr{uint8_t(bits >> 24), uint8_t(bits >> 16),
+                              uint8_t(bits >> 8), uint8_t(bits)};
+    prefixes.push_back({addr, len, id});
+    builder.add_prefix({addr}, len, id);
+  }
+  geo::Record seattle{};
+  std::strcpy(seattle.market_iso, "SEA");
+  IPAddress v6{IPAddress::ipv6_type{0x20, 0x01, 0x0d, 0xb8}};
+  builder.add_prefix(v6, 32, builder.add_record(seattle));
+  geo::Table table = builder.build();
+
+  auto brute_force = [&](uint32_t ip) {
+    const Prefix* best = nullptr;
+    for (auto& p : prefixes) {
+      uint32_t net = p.addr[0] << 24 | p.addr[1] << 16 | p.addr[2] << 8 |
+                     p.addr[3];
+      uint32_t mask = ~uint32_t(0) << (32 - p.len);
+      if ((ip & mask) == (net & mask) && (!best || p.len >= best->len))
+        best = &p;
+    }
+    return best ? int64_t(best->record) : -1;
+  };
+  auto lookup = [&](const geo::Table& t, uint32_t ip) {
+    IPAddress addr{IPAddress::ipv4_type{uint8_t(ip >> 24), uint8_t(ip >> 16),
+                                        uint8_t(ip >> 8), uint8_t(ip)}};
+    auto* rec = t.find(addr);
+    return rec ? int64_t(rec->asn) : -1;
+  };
+  size_t mismatches = 0;
+  for (int i = 0; i < 5000; ++i) {
+    uint32_t ip = rng() & 0x0FFFFFFF;
+    mismatches += lookup(table, ip) != brute_force(ip);
+  }
+  EXPECT_EQ(mismatches, 0u);
+
+  // snapshots are used in place after an mmap
+  char path[] = "/tmp/ipc_runner.XXXXXX";
+  close(mkstemp(path));
+  table.save(path);
+  geo::Table loaded = geo::Table::load(path);
+  unlink(path);
+  EXPECT_EQ(lookup(loaded, 0x01020304), lookup(table, 0x01020304));
+
+  IPAddress inside{IPAddress::ipv6_type{0x20, 0x01, 0x0d, 0xb8, 0, 1}};
+  IPAddress outside{IPAddress::ipv6_type{0x20, 0x01, 0x0d, 0xb9}};
+  EXPECT_EQ(loaded.find(outside), nullptr);
+  if (auto* rec = loaded.find(inside)) {
+    SomeRequest req;
+    geo::fill(req.location, *rec);
+    EXPECT_EQ(req.location.market_iso, "SEA");
+  } else {
+    EXPECT_EQ(loaded.find(inside) != nullptr, true);
+  }
+}
+
+// more variant fields than an iovec stream holds inline
+struct Route : marshalling::SerializedType<Route> {
+  struct Hops {
+    IPAddress a, b, c, d, e, f, g, h, i, j, k, l;
+
+    template <typename Archive>
+    void marshal(Archive& ar) {
+      ar(a, b, c, d, e, f, g, h, i, j, k, l);
+    }
+    template <typename Archive>
+    void marshal(Archive& ar) const {
+      ar(a, b, c, d, e, f, g, h, i, j, k, l);
+    }
+  };
+  Hops first, second, third;
+
+  template <typename Archive>
+  void marshal(Archive& ar) {
+    ar(first, second, third, strings_);
+  }
+  template <typename Archive>
+  void marshal(Archive& ar) const {
+    ar(first, second, third, strings_);
+  }
+};
+
+void variant_encoding() {
+  // a tag byte and the active alternative, not the whole variant
+  IPAddress v4{IPAddress::ipv4_type{192, 168, 0, 1}};
+  EXPECT_EQ(marshalling::byte_size(v4), 5u);
+
+  std::vector<uint8_t> bytes;
+  {
+    SomeRequest req;
+    req.location.ip_address.data = IPAddress::ipv6_type{0xfe, 0x80};
+    req.location.asn = 64512;
+    req.location.market_iso = "SEA";
+    marshalling::write_item(bytes, req);
+  }
+  {
+    SomeRequest req;
+    marshalling::read_item(bytes, req);
+    auto* v6 = std::get_if<IPAddress::ipv6_type>(&req.location.ip_address.data);
+    EXPECT_EQ(v6 && (*v6)[0] == 0xfe && (*v6)[1] == 0x80, true);
+    EXPECT_EQ(req.location.asn, 64512u);
+    EXPECT_EQ(req.location.market_iso, "SEA");
+  }
+
+  bytes = {1, 0, 0, 0, 0};  // tag 1 (IPv6) without its 16 bytes
+  bool threw = false;
+  try {
+    marshalling::read_item(bytes, v4);
+  } catch (const std::out_of_range&) {
+    threw = true;
+  }
+  EXPECT_EQ(threw, true);
+
+  // each tag is its own iovec, which must survive the tags
+  // outgrowing their inline storage
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  {
+    Route route;
+    route.first.a.data = IPAddress::ipv6_type{0xfe, 0x80};
+    route.third.l.data = IPAddress::ipv6_type{0x20, 0x01};
+    rpc::write_frame(fds[0], rpc::FrameHeader{}, route);
+  }
+  {
+    Route route;
+    rpc::FrameReader reader{fds[1]};
+    rpc::Frame frame;
+    EXPECT_EQ(reader.next(frame), true);
+    rpc::read_frame(frame, route);
+    auto* first = std::get_if<IPAddress::ipv6_type>(&route.first.a.data);
+    auto* last = std::get_if<IPAddress::ipv6_type>(&route.third.l.data);
+    EXPECT_EQ(first && (*first)[1] == 0x80, true);
+    EXPECT_EQ(last && (*last)[1] == 0x01, true);
+    EXPECT_EQ(route.second.f.data.index(), 0u);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void header_index() {
+  std::vector<uint8_t> bytes;
+  {
+    SomeRequest req;
+    for (auto* name : {"Host", "Accept", "VARY", "X-Forwarded-For", "vary"}) {
+      auto& h = req.headers.emplace_back();
+      h.name = name;
+      h.value = name;
+    }
+    marshalling::write_item(bytes, req);
+  }
+  {
+    SomeRequest req;
+    marshalling::read_item(bytes, req);
+    auto* vary = req.find_header("Vary");
+    EXPECT_EQ(vary && vary->value == "VARY", true);  // first one wins
+    auto* xff = req.find_header("x-forwarded-for");
+    EXPECT_EQ(xff && xff->value == "X-Forwarded-For", true);
+    EXPECT_EQ(req.find_header("Varyx"), nullptr);
+    EXPECT_EQ(req.find_header("Accep"), nullptr);
+
+    // headers added after decode are found by a scan
+    auto& h = req.headers.emplace_back();
+    h.name = "Cookie";
+    EXPECT_EQ(req.find_header("cookie"), &h);
+
+    // and those dropped after decode aren't
+    req.headers.resize(2);
+    EXPECT_EQ(req.find_header("vary"), nullptr);
+    EXPECT_EQ(req.find_header("accept"), &req.headers[1]);
+  }
+}
+
+void provider_scoring() {
+  scoring::ScoreTable table{4, 100};
+  for (uint32_t p = 0; p < 100; ++p)
+    table.set(2, p, float(p % 10));
+  table.set_weight(7, 0.5f);  // 7 * 0.5 loses to the 6s
+
+  SomeRequest req;
+  req.location.market = 2;
+  for (uint32_t id : {3u, 7u, 250u, 9u, 16u, 19u, 29u, 6u, 4000000000u, 5u}) {
+    auto& p = req.providers.emplace_back();
+    p.id = id;
+    p.name = std::to_string(id);
+  }
+  {
+    SomeResponse resp;
+    EXPECT_EQ(scoring::rank_providers(req, table, 4, resp), 4u);
+    EXPECT_EQ(resp.answers[0].answer, "9");  // ties go to the earlier
+    EXPECT_EQ(resp.answers[1].answer, "19");
+    EXPECT_EQ(resp.answers[2].answer, "29");
+    EXPECT_EQ(resp.answers[3].answer, "16");
+  }
+  {
+    // only the known ids are ranked
+    SomeResponse resp;
+    EXPECT_EQ(scoring::rank_providers(req, table, 20, resp), 8u);
+    req.location.market = 4;
+    EXPECT_EQ(scoring::rank_providers(req, table, 1, resp), 0u);
+  }
+
+  // the dispatched kernels agree with the scalar ones
+  std::mt19937 rng{7};
+  std::vector<float> row(1000), weights(1000);
+  for (size_t i = 0; i < row.size(); ++i) {
+    row[i] = float(rng() % 50);
+    weights[i] = float(rng() % 4) / 2;
+  }
+  std::vector<uint32_t> ids(301);
+  for (auto& id : ids)
+    id = rng() % 1100;
+  std::vector<float> fast(ids.size()), slow(ids.size());
+  scoring::detail::score(row.data(), weights.data(), 1000, ids.data(),
+                         ids.size(), fast.data());
+  scoring::detail::score_scalar(row.data(), weights.data(), 1000, ids.data(),
+                                ids.size(), slow.data());
+  EXPECT_EQ(fast == slow, true);
+
+  uint32_t fast_best[10], slow_best[10];
+  float fast_scores[10], slow_scores[10];
+  scoring::detail::TopK fast_top{fast_best, fast_scores, 10};
+  scoring::detail::TopK slow_top{slow_best, slow_scores, 10};
+  scoring::detail::top_k(fast.data(), fast.size(), fast_top);
+  scoring::detail::top_k_scalar(slow.data(), slow.size(), slow_top);
+  EXPECT_EQ(fast_top.count, 10u);
+  EXPECT_EQ(std::equal(fast_best, fast_best + 10, slow_best), true);
+}
+
+void response_cache() {
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  rpc::Client<SomeRequest, SomeResponse> client{fds[0]};
+  rpc::Server<SomeRequest, SomeResponse> server{fds[1]};
+  rpc::ResponseCache cache{64};
+
+  std::vector<std::string> answers;
+  std::pair<const char*, uint32_t> calls[] = {
+      {"a", 1}, {"a", 1}, {"b", 1}, {"a", 2}};
+  for (auto& call : calls) {
+    SomeRequest req;
+    req.query.method = call.first;
+    req.location.market = call.second;
+    req.headers.emplace_back().name = "not-in-the-key";
+    client.call(req, [&](SomeResponse& resp) {
+      answers.emplace_back(*resp.answers[0].answer);
+    });
+  }
+
+  int handled = 0;
+  for (int i = 0; i < 4; ++i) {
+    server.serve([&](uint32_t call_id, SomeRequest& req) {
+      if (auto hit = cache.find(req))
+        return server.respond(call_id, *hit);
+      SomeResponse resp;
+      resp.response.ttl = 60;
+      resp.answers.emplace_back().answer =
+          std::string(*req.query.method) + std::to_string(++handled);
+      server.respond(call_id, *cache.insert(req, resp, server.options()));
+    });
+  }
+  client.drain();
+  EXPECT_EQ(handled, 3);
+  EXPECT_EQ(cache.hits(), 1u);
+  EXPECT_EQ(cache.size(), 3u);
+  EXPECT_EQ(answers.size(), 4u);
+  EXPECT_EQ(answers[1], "a1");
+  EXPECT_EQ(answers[3], "a3");
+  close(fds[0]);
+  close(fds[1]);
+
+  // entries expire after their ttl, and a zero ttl isn't kept
+  auto now = rpc::ResponseCache::Clock::now();
+  rpc::ResponseCache small{1, 1};
+  {
+    SomeRequest req;
+    req.query.method = "x";
+    SomeResponse resp;
+    resp.response.ttl = 5;
+    small.insert(req, resp, {}, now);
+    EXPECT_EQ(small.find(req, now + std::chrono::seconds{4}) != nullptr, true);
+    EXPECT_EQ(small.find(req, now + std::chrono::seconds{5}), nullptr);
+    EXPECT_EQ(small.size(), 0u);
+  }
+  {
+    SomeRequest req;
+    req.query.method = "y";
+    SomeResponse resp;
+    small.insert(req, resp, {}, now);
+    EXPECT_EQ(small.size(), 0u);
+  }
+
+  // and the least recently used goes when it's full
+  for (auto* method : {"a", "b"}) {
+    SomeRequest req;
+    req.query.method = method;
+    SomeResponse resp;
+    resp.response.ttl = 5;
+    small.insert(req, resp, {}, now);
+  }
+  EXPECT_EQ(small.size(), 1u);
+  for (auto* method : {"a", "b"}) {
+    SomeRequest req;
+    req.query.method = method;
+    EXPECT_EQ(small.find(req, now) != nullptr, (*method == 'b'));
+  }
+}
+
+void latency_histogram() {
+  Histogram h;
+  for (uint64_t v = 1; v <= 1000; ++v)
+    h.record(v * 1000);
+  EXPECT_EQ(h.count(), 1000u);
+  EXPECT_EQ(h.min(), 1000u);
+  EXPECT_EQ(h.max(), 1000000u);
+  // within a bucket (1/16th) of the exact value
+  auto p50 = h.percentile(50), p999 = h.percentile(99.9);
+  EXPECT_EQ(p50 >= 500000 && p50 < 500000 + 500000 / 16, true);
+  EXPECT_EQ(p999 >= 999000 && p999 <= 1000000, true);
+  EXPECT_EQ(h.count_at_or_under(1000), 1u);
+
+  Histogram small;
+  small.record(3, 2);
+  h.merge(small);
+  EXPECT_EQ(h.percentile(0), 3u);
+  EXPECT_EQ(h.count(), 1002u);
+}
+
+void sharded_server() {
+  using Server = rpc::ShardedServer<SomeRequest, SomeResponse>;
+  Server::Options opts;
+  opts.cores = 2;
+  opts.loopback = true;
+  Server server{opts, [](const SomeRequest& req, SomeResponse& resp) {
+                  resp.answers.emplace_back().answer = *req.query.method;
+                }};
+
+  // both workers are listening on the one port
+  std::vector<std::string> answers;
+  for (int i = 0; i < 4; ++i) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server.port());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+              0);
+    rpc::Client<SomeRequest, SomeResponse> client{fd};
+    for (auto* method : {"a", "b"}) {
+      SomeRequest req;
+      req.query.method = method;
+      client.call(req, [&](SomeResponse& resp) {
+        answers.emplace_back(*resp.answers[0].answer);
+      });
+    }
+    client.drain();
+    close(fd);
+  }
+  EXPECT_EQ(answers.size(), 8u);
+  EXPECT_EQ(answers[7], "b");
+
+  server.stop();
+  EXPECT_EQ(server.cores(), 2u);
+  EXPECT_EQ(server.stats(0).requests + server.stats(1).requests, 8u);
+  EXPECT_EQ(server.stats(0).connections + server.stats(1).connections, 4u);
+
+  // half a frame on one connection mustn't hold up another on
+  // the same core, or stop()
+  opts.cores = 1;
+  Server single{opts, [](const SomeRequest&, SomeResponse& resp) {
+                  resp.answers.emplace_back().answer = "ok";
+                }};
+  auto connect_single = [&] {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(single.port());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+              0);
+    return fd;
+  };
+  int stalled = connect_single();
+  uint8_t half[12] = {};
+  uint32_t header = marshalling::Stream::TAG | 100;
+  std::memcpy(half, &header, sizeof(header));
+  EXPECT_EQ(write(stalled, half, sizeof(half)), ssize_t(sizeof(half)));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  int fd = connect_single();
+  rpc::Client<SomeRequest, SomeResponse> client{fd};
+  std::string answer;
+  client.call(SomeRequest{},
+              [&](SomeResponse& resp) { answer = *resp.answers[0].answer; });
+  client.drain();
+  EXPECT_EQ(answer, "ok");
+  single.stop();
+  EXPECT_EQ(single.stats(0).requests, 1u);
+  close(fd);
+  close(stalled);
+}
+
+void flow_control() {
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  rpc::Client<SomeRequest, SomeResponse> client{fds[0]};
+
+  // a window of two means no read sees more than two requests
+  size_t most_read = 0, most_queued = 0;
+  std::thread serving([&] {
+    rpc::Server<SomeRequest, SomeResponse> server{fds[1]};
+    server.set_window(2);
+    size_t n;
+    while ((n = server.serve_batch([&](uint32_t call_id, SomeRequest&) {
+              most_queued = std::max(most_queued, server.queue_depth());
+              SomeResponse resp;
+              server.respond(call_id, resp);
+            })) > 0) {
+      most_read = std::max(most_read, n);
+    }
+  });
+  client.set_flow_control(true);
+  size_t answered = 0;
+  for (int i = 0; i < 20; ++i) {
+    SomeRequest req;
+    client.call(req, [&](SomeResponse&) { ++answered; });
+  }
+  EXPECT_EQ(client.queued(), 20u);
+  client.drain();
+  shutdown(fds[0], SHUT_WR);
+  serving.join();
+  EXPECT_EQ(answered, 20u);
+  EXPECT_EQ(client.queued(), 0u);
+  EXPECT_EQ(most_read <= 2, true);
+  EXPECT_EQ(most_queued, 1u);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void load_shedding() {
+  using namespace std::chrono_literals;
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  rpc::Client<SomeRequest, SomeResponse> client{fds[0]};
+  rpc::Server<SomeRequest, SomeResponse> server{fds[1]};
+  std::vector<uint32_t> shed;
+  client.set_shed_callback([&](uint32_t call_id) { shed.push_back(call_id); });
+
+  // both arrive in one read; the slow first one uses up the
+  // second's budget, so it's shed without being decoded
+  size_t answered = 0;
+  for (int i = 0; i < 2; ++i) {
+    SomeRequest req;
+    client.call(req, [&](SomeResponse&) { ++answered; }, 2000us);
+  }
+  int handled = 0;
+  for (int i = 0; i < 2; ++i) {
+    server.serve([&](uint32_t call_id, SomeRequest&) {
+      ++handled;
+      std::this_thread::sleep_for(5ms);
+      SomeResponse resp;
+      server.respond(call_id, resp);
+    });
+  }
+  client.drain();
+  EXPECT_EQ(handled, 1);
+  EXPECT_EQ(answered, 1u);
+  EXPECT_EQ(server.shed_count(), 1u);
+  EXPECT_EQ(server.queue_depth(), 0u);
+  EXPECT_EQ(client.shed_count(), 1u);
+  EXPECT_EQ(shed.size() == 1 && shed[0] == 2, true);
+
+  // time on the wire counts too: this one has sat in the
+  // socket past its budget before the server reads it
+  {
+    SomeRequest req;
+    client.call(req, [&](SomeResponse&) { ++answered; }, 2000us);
+  }
+  std::this_thread::sleep_for(5ms);
+  server.serve([&](uint32_t, SomeRequest&) { ++handled; });
+  client.drain();
+  EXPECT_EQ(handled, 1);
+  EXPECT_EQ(server.shed_count(), 2u);
+  EXPECT_EQ(client.shed_count(), 2u);
+
+  // a call that runs out of budget waiting for credit never
+  // leaves the client
+  client.set_flow_control(true);
+  {
+    SomeRequest req;
+    client.call(req, [&](SomeResponse&) { ++answered; }, 1000us);
+  }
+  std::this_thread::sleep_for(5ms);
+  server.set_window(1);
+  client.drain();
+  EXPECT_EQ(client.shed_count(), 3u);
+  EXPECT_EQ(answered, 1u);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void load_generator() {
+  using namespace std::chrono_literals;
+  loadgen::Mix mix;
+  for (auto* method : {"a", "b"}) {
+    SomeRequest req;
+    req.query.method = method;
+    mix.add(req, *method == 'a' ? 3 : 1);
+  }
+  mix.shuffle(1000);
+
+  int fds[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  size_t a = 0, b = 0;
+  std::thread serving([&] {
+    rpc::Server<SomeRequest, SomeResponse> server{fds[1]};
+    while (server.serve_batch([&](uint32_t call_id, SomeRequest& req) {
+      ++(req.query.method == "a" ? a : b);
+      SomeResponse resp;
+      server.respond(call_id, resp);
+    })) {
+    }
+  });
+
+  auto closed = loadgen::closed_loop(fds[0], mix, 8, 20ms);
+  EXPECT_EQ(closed.sent > 8, true);
+  EXPECT_EQ(closed.answered, closed.sent);
+  EXPECT_EQ(closed.latency.count(), closed.sent);
+
+  auto open = loadgen::open_loop(fds[0], mix, 5000, 20ms);
+  EXPECT_EQ(open.sent > 50 && open.sent < 200, true);
+  EXPECT_EQ(open.answered, open.sent);
+  EXPECT_EQ(open.latency.count(), open.sent);
+
+  shutdown(fds[0], SHUT_WR);
+  serving.join();
+  // the mix leans three to one toward "a"
+  EXPECT_EQ(a + b, closed.sent + open.sent);
+  EXPECT_EQ(a > 2 * b, true);
+  close(fds[0]);
+  close(fds[1]);
+}
+
 void run() {
+  sparse_encoding();
+  pipelined_rpc();
+  lz_codec();
+  compressed_rpc();
+  capture_replay();
+  frame_index();
+  direct_image();
+  geo_lookup();
+  variant_encoding();
+  header_index();
+  provider_scoring();
+  response_cache();
+  latency_histogram();
+  sharded_server();
+  flow_control();
+  load_shedding();
+  load_generator();
+
   std::vector<uint8_t> bytes;
   {
     SomeRequest req;
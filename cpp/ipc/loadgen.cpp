@@ -0,0 +1,256 @@
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "api.h"
+#include "capture.h"
+#include "loadgen.h"
+#include "net.h"
+#include "shard_server.h"
+
+//
+// Load tests an rpc server for SomeRequest.
+//
+//     loadgen [--closed N | --rate N] [--seconds N] [--capture FILE]
+//             [--connect HOST:PORT | --loopback CORES]
+//             [--slo-p99 US] [--histogram]
+//
+// --closed keeps N calls outstanding (the default, 32).
+// --rate sends N calls a second open loop; with --slo-p99
+// it steps the rate up by a quarter at a time to find the
+// highest whose p99 stays within the SLO.
+//
+// Requests come from --capture if given, otherwise from a
+// built-in mix of templates.  The server is --connect's, or
+// a ShardedServer on loopback with --loopback, or by default
+// one in this process over a socketpair.
+//
+
+namespace darr {
+namespace {
+
+struct Options {
+  size_t closed{0};
+  double rate{0};
+  double seconds{5};
+  std::string capture;
+  std::string connect;
+  size_t loopback{0};
+  double slo_p99_us{0};
+  bool histogram{false};
+};
+
+void usage() {
+  std::cerr << "usage: loadgen [--closed N | --rate N] [--seconds N] "
+               "[--capture FILE]\n"
+               "               [--connect HOST:PORT | --loopback CORES] "
+               "[--slo-p99 US] [--histogram]\n";
+  exit(2);
+}
+
+Options parse_args(int argc, char** argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--closed" && has_value) {
+      opts.closed = std::stoul(argv[++i]);
+    } else if (arg == "--rate" && has_value) {
+      opts.rate = std::stod(argv[++i]);
+    } else if (arg == "--seconds" && has_value) {
+      opts.seconds = std::stod(argv[++i]);
+    } else if (arg == "--capture" && has_value) {
+      opts.capture = argv[++i];
+    } else if (arg == "--connect" && has_value) {
+      opts.connect = argv[++i];
+    } else if (arg == "--loopback" && has_value) {
+      opts.loopback = std::stoul(argv[++i]);
+    } else if (arg == "--slo-p99" && has_value) {
+      opts.slo_p99_us = std::stod(argv[++i]);
+    } else if (arg == "--histogram") {
+      opts.histogram = true;
+    } else {
+      usage();
+    }
+  }
+  if ((opts.closed && opts.rate > 0) || (opts.slo_p99_us > 0 && opts.rate <= 0))
+    usage();
+  if (opts.rate <= 0 && opts.closed == 0)
+    opts.closed = 32;
+  return opts;
+}
+
+// A few lookups, weighted roughly like production traffic
+loadgen::Mix template_mix() {
+  loadgen::Mix mix;
+  struct Template {
+    const char* type;
+    uint32_t market;
+    int providers;
+    double weight;
+  };
+  for (auto& t : {Template{"A", 1, 4, 50}, Template{"A", 7, 12, 20},
+                  Template{"AAAA", 1, 4, 20}, Template{"TXT", 3, 0, 5},
+                  Template{"CNAME", 12, 32, 5}}) {
+    SomeRequest req;
+    req.query.method = "GET";
+    req.query.type = t.type;
+    req.query.prefix = "www.example.com";
+    req.location.market = t.market;
+    for (int i = 0; i < t.providers; ++i) {
+      auto& p = req.providers.emplace_back();
+      p.id = i;
+      p.name = "provider-" + std::to_string(i);
+    }
+    auto& h = req.headers.emplace_back();
+    h.name = "User-Agent";
+    h.value = "loadgen";
+    mix.add(req, t.weight);
+  }
+  return mix;
+}
+
+void handle(const SomeRequest& req, SomeResponse& resp) {
+  resp.response.ttl = 60;
+  for (auto& p : req.providers) {
+    auto& answer = resp.answers.emplace_back();
+    answer.answer = *p.name;
+    answer.ok = true;
+  }
+}
+
+// something to send to, for as long as it's in scope
+class Target {
+ public:
+  explicit Target(const Options& opts) {
+    if (opts.loopback) {
+      Sharded::Options server_opts;
+      server_opts.cores = opts.loopback;
+      server_opts.loopback = true;
+      sharded_.reset(new Sharded{server_opts, handle});
+      address_ = "127.0.0.1:" + std::to_string(sharded_->port());
+    } else {
+      address_ = opts.connect;
+    }
+  }
+  ~Target() {
+    for (auto& t : local_)
+      t.join();
+  }
+
+  // a fresh connection; the local server gets a thread for it
+  int connect() {
+    if (!address_.empty())
+      return net::connect_to(address_);
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    local_.emplace_back([fd = fds[1]] {
+      rpc::Server<SomeRequest, SomeResponse> server{fd};
+      while (server.serve_batch([&](uint32_t call_id, SomeRequest& req) {
+        SomeResponse resp;
+        handle(req, resp);
+        server.respond(call_id, resp);
+      })) {
+      }
+      close(fd);
+    });
+    return fds[0];
+  }
+
+ private:
+  using Sharded = rpc::ShardedServer<SomeRequest, SomeResponse>;
+  std::string address_;
+  std::unique_ptr<Sharded> sharded_;
+  std::vector<std::thread> local_;
+};
+
+void report(const char* label, const loadgen::Result& r, const Options& opts) {
+  auto& h = r.latency;
+  std::printf("%s: sent %llu, answered %llu, shed %llu in %.2fs\n", label,
+              (unsigned long long)r.sent, (unsigned long long)r.answered,
+              (unsigned long long)r.shed, r.seconds);
+  std::printf("  qps %.0f", r.qps());
+  if (opts.slo_p99_us > 0) {
+    auto slo = std::chrono::nanoseconds(uint64_t(opts.slo_p99_us * 1e3));
+    std::printf(", %.0f within %.0fus", r.qps_within(slo), opts.slo_p99_us);
+  }
+  std::printf("\n  latency us: mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  "
+              "p999 %.1f  max %.1f\n",
+              h.mean() / 1e3, h.percentile(50) / 1e3, h.percentile(90) / 1e3,
+              h.percentile(99) / 1e3, h.percentile(99.9) / 1e3,
+              h.max() / 1e3);
+  if (opts.histogram) {
+    uint64_t seen = 0;
+    h.for_each_bucket([&](uint64_t upper, uint64_t count) {
+      seen += count;
+      std::printf("  <= %10.1fus %10llu  %7.3f%%\n", upper / 1e3,
+                  (unsigned long long)count, 100.0 * seen / h.count());
+    });
+  }
+}
+
+loadgen::Result run_once(Target& target, const loadgen::Mix& mix,
+                         const Options& opts, double rate) {
+  auto length = std::chrono::duration_cast<loadgen::Clock::duration>(
+      std::chrono::duration<double>(opts.seconds));
+  int fd = target.connect();
+  auto r = rate > 0 ? loadgen::open_loop(fd, mix, rate, length)
+                    : loadgen::closed_loop(fd, mix, opts.closed, length);
+  close(fd);
+  return r;
+}
+
+int run(const Options& opts) {
+  signal(SIGPIPE, SIG_IGN);
+  loadgen::Mix mix;
+  if (!opts.capture.empty()) {
+    capture::CaptureReader in{opts.capture};
+    mix.add_capture(in);
+  } else {
+    mix = template_mix();
+  }
+  mix.shuffle(1 << 16);
+  Target target{opts};
+
+  if (opts.rate <= 0) {
+    report("closed loop", run_once(target, mix, opts, 0), opts);
+    return 0;
+  }
+  if (opts.slo_p99_us <= 0) {
+    report("open loop", run_once(target, mix, opts, opts.rate), opts);
+    return 0;
+  }
+
+  // step up until p99 breaks the SLO
+  double best = 0;
+  for (double rate = opts.rate;; rate *= 1.25) {
+    auto r = run_once(target, mix, opts, rate);
+    std::string label = "open loop at " + std::to_string(int64_t(rate));
+    report(label.c_str(), r, opts);
+    if (r.latency.percentile(99) > opts.slo_p99_us * 1e3 || r.shed)
+      break;
+    best = rate;
+  }
+  std::printf("highest rate within p99 %.0fus: %.0f/s\n", opts.slo_p99_us,
+              best);
+  return best > 0 ? 0 : 1;
+}
+}  // namespace
+}  // namespace darr
+
+int main(int argc, char** argv) {
+  auto opts = darr::parse_args(argc, argv);
+  try {
+    return darr::run(opts);
+  } catch (const std::exception& e) {
+    std::cerr << "loadgen: " << e.what() << "\n";
+    return 1;
+  }
+}
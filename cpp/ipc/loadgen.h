@@ -0,0 +1,215 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <exception>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "capture.h"
+#include "histogram.h"
+#include "rpc.h"
+
+//
+// Drives an rpc server over a connected socket and measures
+// how long it takes to answer.
+//
+//     loadgen::Mix mix;
+//     mix.add(req, 0.7);              // a template, by weight
+//     mix.add_capture(reader);        // or recorded requests
+//
+//     auto r = loadgen::closed_loop(fd, mix, 64, 10s);
+//     auto r = loadgen::open_loop(fd, mix, 50000, 10s);
+//     r.latency.percentile(99.9);
+//
+// Closed loop keeps a fixed number of calls outstanding, so
+// it finds the throughput for a given concurrency.  Open loop
+// sends on a schedule of Poisson arrivals at the given rate
+// whether or not answers keep up, and times each call from
+// when it was due to be sent, not when it went out; a server
+// that stalls is charged for every call that should have
+// gone out meanwhile (no coordinated omission).
+//
+// Requests are marshalled once when they're added to the mix,
+// so the driver only copies bytes to the socket.  It ignores
+// the server's flow control, to measure what happens without.
+//
+
+namespace darr {
+namespace loadgen {
+
+using Clock = rpc::Clock;
+
+// request payloads to send, each one already marshalled
+class Mix {
+ public:
+  template <typename RequestT>
+  void add(const RequestT& req, double weight = 1) {
+    payloads_.emplace_back();
+    marshalling::write_item(payloads_.back(), req);
+    weights_.push_back(weight);
+  }
+
+  // adds every frame in the capture, with equal weight
+  void add_capture(capture::CaptureReader& in, double weight = 1) {
+    in.rewind();
+    const uint8_t* payload;
+    size_t len;
+    while (in.next(payload, len)) {
+      payloads_.emplace_back(payload, payload + len);
+      weights_.push_back(weight);
+    }
+  }
+
+  // Picks `n` payloads by weight, up front, so the send loop
+  // doesn't roll dice; pick(i) then cycles through them
+  void shuffle(size_t n, uint64_t seed = 1) {
+    if (payloads_.empty())
+      throw std::out_of_range("empty request mix");
+    std::mt19937_64 rng{seed};
+    std::discrete_distribution<size_t> dist{weights_.begin(), weights_.end()};
+    order_.resize(n);
+    for (auto& i : order_)
+      i = dist(rng);
+  }
+
+  const std::vector<uint8_t>& pick(size_t i) const {
+    return payloads_[order_.empty() ? i % payloads_.size()
+                                    : order_[i % order_.size()]];
+  }
+  size_t size() const { return payloads_.size(); }
+
+ private:
+  std::vector<std::vector<uint8_t>> payloads_;
+  std::vector<double> weights_;
+  std::vector<uint32_t> order_;
+};
+
+struct Result {
+  Histogram latency;  // ns
+  uint64_t sent{0};
+  uint64_t answered{0};
+  uint64_t shed{0};
+  double seconds{0};  // first send to last answer
+
+  double qps() const { return seconds > 0 ? answered / seconds : 0; }
+  // answers per second that came back within `slo`
+  double qps_within(std::chrono::nanoseconds slo) const {
+    return seconds > 0 ? latency.count_at_or_under(slo.count()) / seconds : 0;
+  }
+};
+
+namespace detail {
+inline uint64_t ns(Clock::duration d) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+inline void send(int fd, uint32_t call_id, const std::vector<uint8_t>& payload) {
+  rpc::write_raw_frame(fd, rpc::make_header(call_id), payload.data(),
+                       payload.size());
+}
+
+// a response, or false for control frames; counts shed calls
+inline bool answered(const rpc::Frame& frame, Result& r) {
+  if (frame.header.flags & rpc::FLAG_CONTROL)
+    return false;
+  if (frame.header.flags & rpc::FLAG_SHED)
+    ++r.shed;
+  else
+    ++r.answered;
+  return true;
+}
+}  // namespace detail
+
+// keeps `outstanding` calls in flight for `length`, then
+// waits for the last answers
+inline Result closed_loop(int fd, const Mix& mix, size_t outstanding,
+                          Clock::duration length) {
+  Result r;
+  rpc::FrameReader reader{fd};
+  std::unordered_map<uint32_t, Clock::time_point> sent_at;
+  uint32_t next_id = 1;
+  auto start = Clock::now();
+  auto until = start + length;
+  auto send_one = [&](Clock::time_point now) {
+    sent_at[next_id] = now;
+    detail::send(fd, next_id, mix.pick(next_id));
+    ++next_id;
+    ++r.sent;
+  };
+
+  for (size_t i = 0; i < outstanding; ++i)
+    send_one(Clock::now());
+  rpc::Frame frame;
+  while (!sent_at.empty() && reader.next(frame)) {
+    if (!detail::answered(frame, r))
+      continue;
+    auto now = Clock::now();
+    auto it = sent_at.find(frame.header.call_id);
+    if (it == sent_at.end())
+      throw std::out_of_range("response for unknown call id");
+    r.latency.record(detail::ns(now - it->second));
+    sent_at.erase(it);
+    if (now < until)
+      send_one(now);
+  }
+  r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return r;
+}
+
+// sends at `rate` calls per second for `length`, then waits
+// for the last answers
+inline Result open_loop(int fd, const Mix& mix, double rate,
+                        Clock::duration length, uint64_t seed = 1) {
+  // the schedule is fixed before we start, so the receiver
+  // can tell when each call was due from its id alone
+  std::vector<Clock::duration> due;
+  std::mt19937_64 rng{seed};
+  std::exponential_distribution<double> gap{rate};
+  for (double t = gap(rng); t < std::chrono::duration<double>(length).count();
+       t += gap(rng))
+    due.push_back(std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(t)));
+
+  Result r;
+  r.sent = due.size();
+  auto start = Clock::now();
+  std::exception_ptr failed;
+  std::thread receiver([&] {
+    try {
+      rpc::FrameReader reader{fd};
+      rpc::Frame frame;
+      while (r.answered + r.shed < due.size() && reader.next(frame)) {
+        if (!detail::answered(frame, r))
+          continue;
+        uint32_t id = frame.header.call_id;
+        if (id == 0 || id > due.size())
+          throw std::out_of_range("response for unknown call id");
+        r.latency.record(detail::ns(Clock::now() - (start + due[id - 1])));
+      }
+    } catch (...) {
+      failed = std::current_exception();
+    }
+  });
+  try {
+    for (uint32_t i = 0; i < due.size(); ++i) {
+      std::this_thread::sleep_until(start + due[i]);
+      detail::send(fd, i + 1, mix.pick(i));
+    }
+  } catch (...) {
+    ::shutdown(fd, SHUT_RDWR);  // so the receiver gives up too
+    receiver.join();
+    throw;
+  }
+  receiver.join();
+  if (failed)
+    std::rethrow_exception(failed);
+  r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return r;
+}
+
+}  // namespace loadgen
+}  // namespace darr
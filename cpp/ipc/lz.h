@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+//
+// A small LZ77 block codec in the style of LZ4, meant for
+// frames of repetitive text like string tables and logs.
+// It favors speed over ratio: one hash probe per position
+// and no entropy coding.
+//
+// A block is a list of sequences, each of which is
+//
+//     token        high nibble: literal count
+//                  low nibble: match length - MIN_MATCH
+//     [255...]     extra literal count when the nibble is 15
+//     literals
+//     offset       two bytes, little endian, back from here
+//     [255...]     extra match length when the nibble is 15
+//
+// The last sequence stops after its literals.  The decoder
+// checks every length and offset, so a corrupt block fails
+// rather than writing out of bounds.
+//
+
+namespace darr {
+namespace lz {
+
+namespace detail {
+enum { MIN_MATCH = 4, HASH_BITS = 12, MAX_OFFSET = 0xFFFF };
+
+inline uint32_t load32(const uint8_t* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t hash(uint32_t seq) {
+  return (seq * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// writes the overflow of a length which didn't fit in its nibble
+inline bool put_length(uint8_t*& out, uint8_t* end, size_t len) {
+  for (; len >= 255; len -= 255) {
+    if (out == end)
+      return false;
+    *out++ = 255;
+  }
+  if (out == end)
+    return false;
+  *out++ = uint8_t(len);
+  return true;
+}
+
+inline bool get_length(const uint8_t*& in, const uint8_t* end, size_t& len) {
+  uint8_t b;
+  do {
+    if (in == end)
+      return false;
+    b = *in++;
+    len += b;
+  } while (b == 255);
+  return true;
+}
+
+// writes one sequence; a zero `match_len` means it is the last
+inline bool put_sequence(uint8_t*& out, uint8_t* end, const uint8_t* lit,
+                         size_t lit_len, size_t offset, size_t match_len) {
+  if (out == end)
+    return false;
+  size_t ml = match_len ? match_len - MIN_MATCH : 0;
+  *out++ = uint8_t((std::min<size_t>(lit_len, 15) << 4) |
+                   std::min<size_t>(ml, 15));
+  if (lit_len >= 15 && !put_length(out, end, lit_len - 15))
+    return false;
+  if (size_t(end - out) < lit_len)
+    return false;
+  std::memcpy(out, lit, lit_len);
+  out += lit_len;
+  if (match_len == 0)
+    return true;
+  if (end - out < 2)
+    return false;
+  *out++ = uint8_t(offset);
+  *out++ = uint8_t(offset >> 8);
+  return ml < 15 || put_length(out, end, ml - 15);
+}
+}  // namespace detail
+
+// the most a block of `len` bytes can grow to
+inline size_t compress_bound(size_t len) { return len + len / 255 + 16; }
+
+// returns the compressed size, or zero if it doesn't fit in `cap`
+inline size_t compress(const uint8_t* src, size_t len, uint8_t* dst,
+                       size_t cap) {
+  using namespace detail;
+  uint32_t table[1 << HASH_BITS] = {};
+  uint8_t* out = dst;
+  uint8_t* end = dst + cap;
+
+  size_t anchor = 0;
+  size_t i = 0;
+  size_t misses = 0;
+  while (len >= MIN_MATCH && i <= len - MIN_MATCH) {
+    uint32_t seq = load32(src + i);
+    uint32_t& slot = table[hash(seq)];
+    size_t cand = slot;
+    slot = uint32_t(i);
+    if (cand < i && i - cand <= MAX_OFFSET && load32(src + cand) == seq) {
+      size_t match = MIN_MATCH;
+      while (i + match < len && src[cand + match] == src[i + match])
+        ++match;
+      if (!put_sequence(out, end, src + anchor, i - anchor, i - cand, match))
+        return 0;
+      i += match;
+      anchor = i;
+      misses = 0;
+    } else {
+      // skip ahead faster through data that isn't compressing
+      i += 1 + (++misses >> 5);
+    }
+  }
+  if (!put_sequence(out, end, src + anchor, len - anchor, 0, 0))
+    return 0;
+  return out - dst;
+}
+
+// true if `src` is a valid block of exactly `dst_len` bytes
+inline bool decompress(const uint8_t* src, size_t len, uint8_t* dst,
+                       size_t dst_len) {
+  using namespace detail;
+  const uint8_t* in = src;
+  const uint8_t* in_end = src + len;
+  uint8_t* out = dst;
+  uint8_t* out_end = dst + dst_len;
+
+  while (in < in_end) {
+    uint8_t token = *in++;
+    size_t lit_len = token >> 4;
+    if (lit_len == 15 && !get_length(in, in_end, lit_len))
+      return false;
+    if (size_t(in_end - in) < lit_len || size_t(out_end - out) < lit_len)
+      return false;
+    std::memcpy(out, in, lit_len);
+    in += lit_len;
+    out += lit_len;
+    if (in == in_end)
+      break;  // the last sequence has no match
+
+    if (in_end - in < 2)
+      return false;
+    size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    if (offset == 0 || offset > size_t(out - dst))
+      return false;
+    size_t match = token & 15;
+    if (match == 15 && !get_length(in, in_end, match))
+      return false;
+    match += MIN_MATCH;
+    if (size_t(out_end - out) < match)
+      return false;
+    // byte at a time since the match can overlap its output
+    const uint8_t* from = out - offset;
+    for (size_t j = 0; j < match; ++j)
+      out[j] = from[j];
+    out += match;
+  }
+  return out == out_end;
+}
+
+}  // namespace lz
+}  // namespace darr
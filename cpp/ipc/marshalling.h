@@ -1,7 +1,13 @@
 #pragma once
 
 #include <sys/uio.h>  // iovec
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
 #include <string_view>
+#include <variant>
 
 #include "small_vector.h"
 
@@ -58,7 +64,26 @@ struct strategy {
   struct marshall_method {};
   struct trivially_copyable {};
   struct trivially_copyable_container {};
+  struct variant {};
+};
+
+template <typename T>
+struct is_variant : std::false_type {};
+template <typename... Ts>
+struct is_variant<std::variant<Ts...>> : std::true_type {};
+
+// checks if a type has a `marshal()` method, by calling it
+// with an archive which accepts anything
+struct any_archive {
+  template <typename... Ts>
+  void operator()(Ts&...) {}
 };
+template <typename T, typename _ = void>
+struct has_marshal_method : std::false_type {};
+template <typename T>
+struct has_marshal_method<T, std::void_t<decltype(std::declval<T&>().marshal(
+                                 std::declval<any_archive&>()))>>
+    : std::true_type {};
 
 // checks if a type is a container of trivially-copyable types
 template <typename T, typename _ = void>
@@ -74,16 +99,37 @@ struct is_container_of_trivially_copyable<
                              decltype(std::declval<T>().data())>,
            void>> : public std::true_type {};
 
-// assigns types to their proper strategy.  If the type is
-// trivially copyable, we copy it, otherwise we assume it has
-// a method we can use.
+// a type may have an `after_load()` method, which readers call
+// once its fields are read, to rebuild anything derived from them
+template <typename T, typename _ = void>
+struct has_after_load : std::false_type {};
+template <typename T>
+struct has_after_load<T, std::void_t<decltype(std::declval<T&>().after_load())>>
+    : std::true_type {};
+template <typename T>
+void after_load(T& item) {
+  if constexpr (has_after_load<T>::value)
+    item.after_load();
+}
+
+// assigns types to their proper strategy.  Variants are
+// written as a tag and their active alternative.  A type with
+// a marshal method uses it, even if it's trivially copyable,
+// so a struct can list its fields to get at a variant inside.
+// Otherwise if the type is trivially copyable, we copy it.
 template <typename T>
 struct strategy_lookup
     : std::conditional<
-          std::is_trivially_copyable<T>::value, strategy::trivially_copyable,
-          std::conditional_t<is_container_of_trivially_copyable<T>::value,
-                             strategy::trivially_copyable_container,
-                             strategy::marshall_method>> {};
+          is_variant<std::remove_cv_t<T>>::value, strategy::variant,
+          std::conditional_t<
+              has_marshal_method<T>::value, strategy::marshall_method,
+              std::conditional_t<
+                  std::is_trivially_copyable<T>::value,
+                  strategy::trivially_copyable,
+                  std::conditional_t<
+                      is_container_of_trivially_copyable<T>::value,
+                      strategy::trivially_copyable_container,
+                      strategy::marshall_method>>>> {};
 }  // namespace
 
 // --- --- STREAMS --- --- --- --- --- --- --- ---
@@ -91,6 +137,12 @@ struct strategy_lookup
 // data to sink
 // ---
 
+// a frame's place in a buffer, header included
+struct FrameSpan {
+  size_t offset;
+  size_t size;
+};
+
 class Stream {
  public:
   // We have a four byte header the top 2 bytes are a tag and
@@ -123,33 +175,83 @@ class Stream {
     }
     return -1;
   }
+
+  struct IndexResult {
+    size_t count;     // spans written
+    size_t consumed;  // bytes covered by those spans
+    bool bad_tag;     // stopped at a header without our tag
+  };
+
+  // Finds the whole frames at the front of a buffer of frames
+  // sent back to back, without throwing.  It stops at a partial
+  // frame, a bad tag or `max_spans`, and reports which.  Each
+  // frame's offset depends on the one before it, so this walk
+  // is serial, but it's a load and a compare per frame; the
+  // spans can then be decoded in parallel.
+  static IndexResult index_frames(const unsigned char* data, size_t len,
+                                  FrameSpan* spans,
+                                  size_t max_spans) noexcept {
+    IndexResult r{0, 0, false};
+    while (r.count < max_spans && len - r.consumed >= HEADER_SIZE) {
+      uint32_t header;
+      memcpy(&header, data + r.consumed, HEADER_SIZE);
+      size_t size = (header & ~MASK) + HEADER_SIZE;
+      if ((header & MASK) != TAG) {
+        r.bad_tag = true;
+        break;
+      }
+      if (size > len - r.consumed)
+        break;
+      spans[r.count++] = {r.consumed, size};
+      r.consumed += size;
+    }
+    return r;
+  }
 };
 
 class IOVecOutputStream {
  public:
-  small_vector<iovec, MARSHALLING_MAX_FIELDS> vecs;
-
   IOVecOutputStream() {
     static_assert(sizeof(size_header) == Stream::HEADER_SIZE, "");
     vecs.push_back({&size_header, sizeof(size_header)});
   }
 
-  void write_size(uint16_t val) {
-    sizes.emplace_back();
-    sizes.back() = val;
-    write(&sizes.back(), sizeof(val));
-  }
+  void write_size(uint16_t val) { write_scalar(&val, sizeof(val)); }
+  void write_tag(uint8_t val) { write_scalar(&val, sizeof(val)); }
   void write(const void* item, size_t size) {
     auto* ptr = const_cast<void*>(item);
     vecs.push_back({ptr, size});
     size_header += size;
   }
 
+  // the iovecs written so far, valid until the next write
+  iovec* iov() {
+    for (uint32_t i : pending) {
+      auto offset = reinterpret_cast<uintptr_t>(vecs[i].iov_base);
+      vecs[i].iov_base = scalars.data() + offset;
+    }
+    pending.resize(0);
+    return vecs.data();
+  }
+  size_t iov_count() const { return vecs.size(); }
+
+ private:
+  // Sizes and tags are copied into `scalars`, which moves to
+  // the heap once it outgrows its inline storage, so their
+  // iovecs hold an offset into it until iov() resolves them.
+  void write_scalar(const void* val, size_t size) {
+    size_t offset = scalars.size();
+    scalars.resize(offset + size);
+    std::memcpy(scalars.data() + offset, val, size);
+    pending.emplace_back(uint32_t(vecs.size()));
+    write(reinterpret_cast<void*>(offset), size);
+  }
+
  private:
   uint32_t size_header{Stream::TAG};
-  // Since we return a pointer to these fields in `vecs`,
-  // they can't move, so we can't use heap.
-  small_vector<uint16_t, MARSHALLING_MAX_FIELDS> sizes{};
+  small_vector<iovec, MARSHALLING_MAX_FIELDS> vecs;
+  small_vector<uint8_t, 2 * MARSHALLING_MAX_FIELDS> scalars{};
+  small_vector<uint32_t, MARSHALLING_MAX_FIELDS> pending{};
 };
 
 template <typename Container>
@@ -157,6 +259,7 @@ struct ContainerOutputStream {
   Container& data;
   ContainerOutputStream(Container& c) : data{c} {}
   void write_size(uint16_t val) { write(&val, sizeof(val)); }
+  void write_tag(uint8_t val) { write(&val, sizeof(val)); }
   void write(const void* item, size_t size) {
     auto* ptr = static_cast<const uint8_t*>(item);
     data.insert(data.end(), ptr, ptr + size);
@@ -168,10 +271,11 @@ struct RangeOutputStream {
   uint8_t* end;
   RangeOutputStream(uint8_t* buf, size_t len) : ptr{buf}, end{buf + len} {}
   void write_size(uint16_t val) { write(&val, sizeof(val)); }
+  void write_tag(uint8_t val) { write(&val, sizeof(val)); }
   void write(const void* item, size_t size) {
     std::memcpy(ptr, item, size);
     ptr += size;
-    assert(ptr < end);
+    assert(ptr <= end);
   }
 };
 
@@ -190,6 +294,19 @@ struct ContainerInputStream {
   }
 };
 
+struct RangeInputStream {
+  const uint8_t* ptr;
+  const uint8_t* end;
+  RangeInputStream(const uint8_t* buf, size_t len)
+      : ptr{buf}, end{buf + len} {}
+  void read(void* item, size_t size) {
+    if (size > size_t(end - ptr))
+      throw std::out_of_range("read buffer too small");
+    std::memcpy(item, ptr, size);
+    ptr += size;
+  }
+};
+
 // used to reset an object to a default state so we
 // can reuse the field list passed to the archiver
 struct Clear {
@@ -200,6 +317,7 @@ struct Clear {
 struct ByteSize {
   size_t bytes{0};
   void write_size(uint16_t val) { write(&val, sizeof(val)); }
+  void write_tag(uint8_t val) { write(&val, sizeof(val)); }
   void write(const void*, size_t size) { bytes += size; }
 };
 
@@ -236,6 +354,39 @@ struct ArraySerializer {
   }
 };
 
+// A one byte tag for the active alternative, and then the
+// alternative itself, written by the archive like any field
+template <typename T>
+struct VariantSerializer {
+  static_assert(std::variant_size<T>::value <= 256, "too many alternatives");
+
+  template <typename StreamT, typename Archive>
+  void store(const T& item, StreamT& buf, Archive& ar) {
+    buf.write_tag(uint8_t(item.index()));
+    std::visit([&](auto& alt) { ar(alt); }, item);
+  }
+  template <typename StreamT, typename Archive>
+  void load(T& item, StreamT& buf, Archive& ar) {
+    uint8_t tag;
+    buf.read(&tag, sizeof(tag));
+    if (tag >= std::variant_size<T>::value)
+      throw std::out_of_range("bad variant tag");
+    emplace(item, tag);
+    std::visit([&](auto& alt) { ar(alt); }, item);
+  }
+
+ private:
+  template <size_t I = 0>
+  static void emplace(T& item, size_t index) {
+    if constexpr (I < std::variant_size<T>::value) {
+      if (I == index)
+        item.template emplace<I>();
+      else
+        emplace<I + 1>(item, index);
+    }
+  }
+};
+
 // --- --- ARCHIVER --- --- --- --- --- --- --- ---
 // Dispatches a list of objects to their proper
 // serializers
@@ -269,6 +420,10 @@ class ArchiveWriter {
     ArraySerializer<T>{}.store(item, stream_);
   }
   template <typename T>
+  void save(strategy::variant, T& item) {
+    VariantSerializer<std::remove_cv_t<T>>{}.store(item, stream_, *this);
+  }
+  template <typename T>
   void save(strategy::marshall_method, T& item) {
     item.marshal(*this);
   }
@@ -303,8 +458,155 @@ class ArchiveReader {
     ArraySerializer<T>{}.load(item, stream_);
   }
   template <typename T>
+  void load(strategy::variant, T& item) {
+    VariantSerializer<T>{}.load(item, stream_, *this);
+  }
+  template <typename T>
+  void load(strategy::marshall_method, T& item) {
+    item.marshal(*this);
+    after_load(item);
+  }
+
+ private:
+  StreamT& stream_;
+};
+
+// --- --- SPARSE ARCHIVER --- --- --- --- --- --- --- ---
+// An alternate encoding where every field list passed to
+// the archiver is prefixed with a presence bitmap, one bit
+// per field.  Fields in their default state (all zero bytes
+// or an empty container) are left out of the stream, so a
+// mostly-default message costs little more than its bitmaps.
+//
+// The bitmap is a local, so this only works with the streams
+// that copy (not IOVecOutputStream).
+// ---
+
+// used to check if an item is in its default state by running
+// it through the normal writer and watching the bytes go by
+struct IsDefault {
+  bool value{true};
+  void write_size(uint16_t val) { value = value && val == 0; }
+  void write_tag(uint8_t val) { value = value && val == 0; }
+  void write(const void* item, size_t size) {
+    auto* ptr = static_cast<const uint8_t*>(item);
+    for (size_t i = 0; value && i < size; ++i)
+      value = ptr[i] == 0;
+  }
+};
+
+template <typename T>
+bool is_default(const T& item) {
+  IsDefault probe;
+  ArchiveWriter<IsDefault> ar{probe};
+  ar(item);
+  return probe.value;
+}
+
+// the smallest integer with a bit for each of N fields
+template <size_t N>
+using presence_bitmap = std::conditional_t<
+    (N <= 8), uint8_t, std::conditional_t<(N <= 16), uint16_t, uint32_t>>;
+
+template <typename StreamT>
+class SparseArchiveWriter {
+ public:
+  SparseArchiveWriter(StreamT& s) : stream_{s} {}
+  template <typename T, typename... Types>
+  void operator()(T& head, Types&... tail) {
+    static_assert(sizeof...(tail) + 1 < MARSHALLING_MAX_FIELDS,
+                  "too many fields");
+    using Bitmap = presence_bitmap<sizeof...(tail) + 1>;
+    Bitmap bits = presence<Bitmap>(1, head, tail...);
+    stream_.write(&bits, sizeof(bits));
+    serialize(bits, head, tail...);
+  }
+
+ private:
+  template <typename Bitmap>
+  Bitmap presence(Bitmap) {
+    return 0;
+  }
+  template <typename Bitmap, typename T, typename... Types>
+  Bitmap presence(Bitmap bit, T& head, Types&... tail) {
+    Bitmap rest = presence<Bitmap>(bit << 1, tail...);
+    return is_default(head) ? rest : (rest | bit);
+  }
+
+  template <typename Bitmap>
+  void serialize(Bitmap) {}  // terminates the recursion
+  template <typename Bitmap, typename T, typename... Types>
+  void serialize(Bitmap bits, T& head, Types&... tail) {
+    if (bits & 1) {
+      using Strategy = typename strategy_lookup<T>::type;
+      save(Strategy{}, head);
+    }
+    serialize<Bitmap>(bits >> 1, tail...);
+  }
+  template <typename T>
+  void save(strategy::trivially_copyable, T& item) {
+    ItemSerializer<T>{}.store(item, stream_);
+  }
+  template <typename T>
+  void save(strategy::trivially_copyable_container, T& item) {
+    ArraySerializer<T>{}.store(item, stream_);
+  }
+  template <typename T>
+  void save(strategy::variant, T& item) {
+    VariantSerializer<std::remove_cv_t<T>>{}.store(item, stream_, *this);
+  }
+  template <typename T>
+  void save(strategy::marshall_method, T& item) {
+    item.marshal(*this);
+  }
+
+ private:
+  StreamT& stream_;
+};
+
+template <typename StreamT>
+class SparseArchiveReader {
+ public:
+  SparseArchiveReader(StreamT& s) : stream_{s} {}
+  template <typename T, typename... Types>
+  void operator()(T& head, Types&... tail) {
+    presence_bitmap<sizeof...(tail) + 1> bits;
+    stream_.read(&bits, sizeof(bits));
+    deserialize(bits, head, tail...);
+  }
+
+ private:
+  template <typename Bitmap>
+  void deserialize(Bitmap) {}
+  template <typename Bitmap, typename T, typename... Types>
+  void deserialize(Bitmap bits, T& head, Types&... tail) {
+    if (bits & 1) {
+      using Strategy = typename strategy_lookup<T>::type;
+      load(Strategy{}, head);
+    } else {
+      // absent fields are reset to their default
+      Clear clr;
+      ArchiveReader<Clear> ar{clr};
+      ar(head);
+    }
+    deserialize<Bitmap>(bits >> 1, tail...);
+  }
+  template <typename T>
+  void load(strategy::trivially_copyable, T& item) {
+    ItemSerializer<T>{}.load(item, stream_);
+  }
+  template <typename T>
+  void load(strategy::trivially_copyable_container, T& item) {
+    ArraySerializer<T>{}.load(item, stream_);
+  }
+  template <typename T>
+  void load(strategy::variant, T& item) {
+    VariantSerializer<T>{}.load(item, stream_, *this);
+  }
+  template <typename T>
   void load(strategy::marshall_method, T& item) {
     item.marshal(*this);
+    after_load(item);
   }
 
  private:
@@ -354,6 +656,80 @@ auto read_item(const Container& c, Item& item) {
   return s.cursor;
 }
 
+template <typename Item>
+ssize_t read_item(const uint8_t* buf, size_t len, Item& item) {
+  RangeInputStream s{buf, len};
+  ArchiveReader<RangeInputStream> ar{s};
+  ar(item);
+  return s.ptr - buf;
+}
+
+// the sparse versions of the above.  The encoding is not
+// self-describing, so both ends need to agree to use it.
+template <typename Item>
+size_t sparse_byte_size(const Item& item) {
+  ByteSize size;
+  SparseArchiveWriter<ByteSize> ar{size};
+  ar(item);
+  return size.bytes;
+}
+
+template <typename Item, typename Container,
+          typename _ = typename Container::value_type>
+ssize_t write_sparse_item(Container& c, Item& item) {
+  using StreamT = ContainerOutputStream<Container>;
+  auto sz = c.size();
+  StreamT s{c};
+  SparseArchiveWriter<StreamT> ar{s};
+  ar(item);
+  return c.size() - sz;
+}
+
+template <typename Item, typename Container>
+auto read_sparse_item(const Container& c, Item& item) {
+  ContainerInputStream<Container> s{c};
+  SparseArchiveReader<ContainerInputStream<Container>> ar{s};
+  ar(item);
+  return s.cursor;
+}
+
+// --- --- DIRECT IMAGE --- --- --- --- --- --- --- ---
+// Since StringPtr is an offset, a type whose fields are all
+// trivially copyable (apart from its string table) can be
+// sent as a copy of its own memory.  See
+// SerializedType::write_direct().
+// ---
+
+// an archive which checks each field is trivially copyable and
+// lies within the object's image, or is the string table, and
+// adds up their sizes: short of the image's, there are members
+// marshal() doesn't list, or padding, which we'd send as is
+struct DirectImageCheck {
+  const uint8_t* begin;
+  const uint8_t* end;
+  const void* strings;
+  bool ok{true};
+  size_t bytes{0};
+
+  template <typename... Types>
+  void operator()(Types&... fields) {
+    check(fields...);
+  }
+
+ private:
+  void check() {}
+  template <typename T, typename... Types>
+  void check(T& head, Types&... tail) {
+    auto* ptr = reinterpret_cast<const uint8_t*>(&head);
+    bool in_image = ptr >= begin && ptr + sizeof(T) <= end;
+    bool is_strings = static_cast<const void*>(&head) == strings;
+    ok = ok && ((std::is_trivially_copyable<T>::value && in_image) ||
+                is_strings);
+    bytes += is_strings ? 0 : sizeof(T);
+    check(tail...);
+  }
+};
+
 // --- --- BASE TYPE --- --- --- --- --- --- --- ---
 // A base class to make the magic work
 // ---
@@ -390,6 +766,7 @@ class SerializedType {
     friend bool operator!=(std::string_view v, StringPtr s) { return s != v; }
 
    private:
+    friend class SerializedType;
     uint16_t offset_{};
   };
 
@@ -414,9 +791,97 @@ class SerializedType {
     strings_.push_back('\0');
   }
 
+  // True if this type can use write_direct(), which is when
+  // every field in marshal() is trivially copyable, apart from
+  // strings_, and together they fill the image: no unlisted
+  // members and no padding between or after them.  It's a
+  // runtime check but folds to a constant.
+  bool has_direct_image() const {
+    DirectImageCheck check{image_begin(), image_end(), &strings_};
+    derived().marshal(check);
+    return check.ok && check.bytes == image_size();
+  }
+
+  // Writes the object as two blocks: its own memory after
+  // strings_, and the used part of strings_.  Skipping the
+  // field walk is only safe if both ends share a binary
+  // layout, so this is for tightly coupled peers.
+  template <typename StreamT>
+  void write_direct(StreamT& out) const {
+    assert(has_direct_image());
+    out.write(image_begin(), image_size());
+    out.write(strings_.data(), strings_.size());
+  }
+
+  // The reverse of write_direct().  The bytes come from a peer,
+  // so this checks the sizes, that the string table is null
+  // terminated at both ends, and after the copy that every
+  // StringPtr points into the table and every variant holds
+  // one of its alternatives.  A bad image leaves us cleared.
+  void read_direct(const uint8_t* buf, size_t len) {
+    if (!has_direct_image())
+      throw std::out_of_range("type has no direct image");
+    size_t image = image_size();
+    if (len <= image || len - image > UINT16_MAX)
+      throw std::out_of_range("bad direct image size");
+    const uint8_t* strings = buf + image;
+    size_t strings_len = len - image;
+    if (strings[0] != '\0' || strings[strings_len - 1] != '\0')
+      throw std::out_of_range("bad direct image string table");
+    std::memcpy(image_begin(), buf, image);
+    strings_.resize(strings_len);
+    std::memcpy(strings_.data(), strings, strings_len);
+    DirectImageValidate valid{strings_len};
+    derived().marshal(valid);
+    if (!valid.ok) {
+      clear();
+      throw std::out_of_range("bad direct image field");
+    }
+    after_load(static_cast<Derived&>(*this));
+  }
+
  protected:
   StringStorage strings_;
 
+ private:
+  const Derived& derived() const { return static_cast<const Derived&>(*this); }
+  // the derived type's members all live after strings_
+  uint8_t* image_begin() { return reinterpret_cast<uint8_t*>(&strings_ + 1); }
+  const uint8_t* image_begin() const {
+    return reinterpret_cast<const uint8_t*>(&strings_ + 1);
+  }
+  const uint8_t* image_end() const {
+    return reinterpret_cast<const uint8_t*>(&derived()) + sizeof(Derived);
+  }
+  size_t image_size() const { return image_end() - image_begin(); }
+
+  // an archive which walks the fields of a copied image and
+  // clears `ok` if any of them couldn't have been written by us
+  struct DirectImageValidate {
+    size_t strings;
+    bool ok{true};
+
+    template <typename... Types>
+    void operator()(const Types&... fields) {
+      (check(fields), ...);
+    }
+
+   private:
+    void check(const StringPtr& str) { ok = ok && str.offset_ < strings; }
+    template <typename T>
+    void check(const T& field) {
+      if constexpr (is_variant<T>::value) {
+        // the index must be checked before visit() trusts it
+        if (field.index() >= std::variant_size<T>::value)
+          ok = false;
+        else
+          std::visit([&](auto& alt) { check(alt); }, field);
+      } else if constexpr (has_marshal_method<T>::value) {
+        field.marshal(*this);
+      }
+    }
+  };
+
  private:
   // this is a pointer to strings_, just above, and it is used
   // to associate StringPtr with this instance
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+//
+// Client-side socket setup shared by the tools.
+//
+//     int fd = net::connect_to("localhost:7000");
+//
+// connect_to tries each address HOST resolves to in turn and
+// returns the first connected socket.  A malformed address
+// throws std::invalid_argument, a name that doesn't resolve
+// std::runtime_error, and a refused connection
+// std::system_error.
+//
+
+namespace darr {
+namespace net {
+
+inline int connect_to(const std::string& host_port) {
+  auto colon = host_port.rfind(':');
+  if (colon == std::string::npos)
+    throw std::invalid_argument(host_port + ": not HOST:PORT");
+  std::string host = host_port.substr(0, colon);
+  std::string port = host_port.substr(colon + 1);
+
+  addrinfo hints{};
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res;
+  if (int rc = ::getaddrinfo(host.c_str(), port.c_str(), &hints, &res))
+    throw std::runtime_error(host_port + ": " + ::gai_strerror(rc));
+  int fd = -1;
+  int err = 0;
+  for (auto* ai = res; ai && fd < 0; ai = ai->ai_next) {
+    fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd >= 0 && ::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+      err = errno;
+      ::close(fd);
+      fd = -1;
+    } else if (fd < 0) {
+      err = errno;
+    }
+  }
+  ::freeaddrinfo(res);
+  if (fd < 0)
+    throw std::system_error(err, std::generic_category(),
+                            "can't connect to " + host_port);
+  return fd;
+}
+
+}  // namespace net
+}  // namespace darr
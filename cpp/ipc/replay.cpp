@@ -0,0 +1,141 @@
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "api.h"
+#include "capture.h"
+#include "net.h"
+#include "rpc.h"
+
+//
+// Replays a capture of SomeRequest frames.
+//
+//     replay [--rate N] [--loops N] [--connect HOST:PORT] FILE
+//
+// Without --connect each frame is decoded locally, which is
+// a quick check that a capture still reads with the current
+// build.  With it, frames are sent as-is to an rpc server and
+// the responses are counted.  --rate paces the sends at N
+// frames per second; the default is as fast as possible.
+//
+
+namespace darr {
+namespace {
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string path;
+  std::string connect;
+  double rate{0};
+  int loops{1};
+};
+
+void usage() {
+  std::cerr << "usage: replay [--rate N] [--loops N] "
+               "[--connect HOST:PORT] FILE\n";
+  exit(2);
+}
+
+Options parse_args(int argc, char** argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--rate" && has_value) {
+      opts.rate = std::stod(argv[++i]);
+    } else if (arg == "--loops" && has_value) {
+      opts.loops = std::stoi(argv[++i]);
+    } else if (arg == "--connect" && has_value) {
+      opts.connect = argv[++i];
+    } else if (arg[0] != '-' && opts.path.empty()) {
+      opts.path = arg;
+    } else {
+      usage();
+    }
+  }
+  if (opts.path.empty())
+    usage();
+  return opts;
+}
+
+// calls fn(payload, len) for each frame, paced to `rate`
+template <typename Fn>
+size_t replay(capture::CaptureReader& in, const Options& opts, Fn&& fn) {
+  size_t count = 0;
+  auto start = Clock::now();
+  for (int loop = 0; loop < opts.loops; ++loop) {
+    in.rewind();
+    const uint8_t* payload;
+    size_t len;
+    while (in.next(payload, len)) {
+      if (opts.rate > 0) {
+        auto due = start + std::chrono::duration_cast<Clock::duration>(
+                               std::chrono::duration<double>(count / opts.rate));
+        std::this_thread::sleep_until(due);
+      }
+      fn(payload, len);
+      ++count;
+    }
+  }
+  return count;
+}
+
+int run(const Options& opts) {
+  capture::CaptureReader in{opts.path};
+  auto start = Clock::now();
+  size_t count = 0;
+  size_t errors = 0;
+
+  if (opts.connect.empty()) {
+    count = replay(in, opts, [&](const uint8_t* payload, size_t len) {
+      try {
+        SomeRequest req;
+        marshalling::read_item(payload, len, req);
+      } catch (const std::exception& e) {
+        if (errors++ == 0)
+          std::cerr << "replay: decode failed: " << e.what() << "\n";
+      }
+    });
+  } else {
+    int fd = net::connect_to(opts.connect);
+    std::atomic<size_t> responses{0};
+    std::thread drain([&] {
+      rpc::Frame frame;
+      rpc::FrameReader reader{fd};
+      while (reader.next(frame))
+        ++responses;
+    });
+    uint32_t call_id = 0;
+    count = replay(in, opts, [&](const uint8_t* payload, size_t len) {
+      rpc::write_raw_frame(fd, rpc::make_header(++call_id), payload, len);
+    });
+    shutdown(fd, SHUT_WR);
+    drain.join();
+    close(fd);
+    errors = count - responses;
+  }
+
+  std::chrono::duration<double> secs = Clock::now() - start;
+  std::cout << "frames:  " << count << "\n"
+            << "errors:  " << errors << "\n"
+            << "seconds: " << secs.count() << "\n"
+            << "rate:    " << count / secs.count() << "/s\n";
+  return errors ? 1 : 0;
+}
+}  // namespace
+}  // namespace darr
+
+int main(int argc, char** argv) {
+  auto opts = darr::parse_args(argc, argv);
+  try {
+    return darr::run(opts);
+  } catch (const std::exception& e) {
+    std::cerr << "replay: " << e.what() << "\n";
+    return 1;
+  }
+}
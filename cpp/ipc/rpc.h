@@ -0,0 +1,670 @@
+#pragma once
+
+#include <poll.h>
+#include <sys/uio.h>  // writev
+#include <unistd.h>   // read
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>  // IOV_MAX
+#include <deque>
+#include <functional>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "capture.h"
+#include "lz.h"
+#include "marshalling.h"
+
+//
+// A pipelined request/response layer over one connected
+// socket.  Each frame carries a call id just after the
+// Stream header, so a client can have many calls in flight
+// and the server can answer them in any order.
+//
+//     rpc::Client<SomeRequest, SomeResponse> client{fd};
+//     client.call(req, [](SomeResponse& resp) { ... });
+//     client.call(req2, [](SomeResponse& resp) { ... });
+//     client.drain();  // runs callbacks as responses arrive
+//
+// On the other end, the handler gets the call id with the
+// request and can respond right away or hang onto the id
+// and respond later
+//
+//     rpc::Server<SomeRequest, SomeResponse> server{fd};
+//     server.serve([&](uint32_t call_id, SomeRequest& req) {
+//       SomeResponse resp;
+//       ...
+//       server.respond(call_id, resp);
+//     });
+//
+// Either end can opt in to compression with set_compression(),
+// which compresses any frame over the given size and flags it
+// in the header.  The receiver decompresses whatever is
+// flagged, so the two ends needn't agree on the threshold.
+//
+// Peers built from the same code can also set_direct_image(),
+// which sends qualifying messages as a copy of their memory
+// (see SerializedType::write_direct) rather than field by field.
+//
+// For flow control, the server can set_window(n), which lets
+// each client have n calls on the wire or in the server's
+// hands; calls past that wait, encoded, at the client.  The
+// server hands back credit in control frames as it answers.
+// A call can also carry a time budget, and the server sheds
+// it without decoding if it's older than that, counted from
+// when the client sent it; the client hears about it through
+// its shed callback.
+//
+// Both ends decode into a local instance of the message, so
+// remember only one instance of each SerializedType can be
+// alive per thread.
+//
+
+namespace darr {
+namespace rpc {
+
+// --- --- FRAMING --- --- --- --- --- --- --- ---
+// An rpc frame is a Stream frame whose payload starts
+// with this header, followed by the marshalled item
+// ---
+
+using Clock = std::chrono::steady_clock;
+
+enum FrameFlags : uint16_t {
+  FLAG_COMPRESSED = 1 << 0,  // payload is an lz block of raw_size bytes
+  FLAG_DIRECT = 1 << 1,      // payload is a direct image
+  FLAG_CONTROL = 1 << 2,     // payload is a Control, not a response
+  FLAG_SHED = 1 << 3,        // the call was dropped unanswered
+};
+
+// how an endpoint writes its frames
+struct FrameOptions {
+  // items of this many bytes or more are compressed if it helps;
+  // zero turns compression off
+  size_t compress_threshold{0};
+  // send items which have a direct image that way
+  bool direct_image{false};
+};
+
+struct FrameHeader {
+  uint32_t call_id{0};
+  uint16_t flags{0};
+  uint16_t raw_size{0};
+  // how long after sent_us answering stops being worth it;
+  // zero is no limit
+  uint32_t budget_us{0};
+  // when the client wrote the call, from wall_us(); zero if
+  // it has no budget
+  uint32_t sent_us{0};
+};
+
+inline FrameHeader make_header(uint32_t call_id, uint16_t flags = 0) {
+  FrameHeader header;
+  header.call_id = call_id;
+  header.flags = flags;
+  return header;
+}
+
+// The system clock in microseconds, cut to 32 bits, to stamp
+// calls with.  Ages are taken modulo 2^32, so they're good to
+// about half an hour, and the two ends' clocks have to agree
+// to well within the budgets in use: the same host, or NTP.
+inline uint32_t wall_us(std::chrono::system_clock::time_point t =
+                            std::chrono::system_clock::now()) {
+  return uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                      t.time_since_epoch())
+                      .count());
+}
+
+// the payload of a FLAG_CONTROL frame, from server to client
+struct Control {
+  uint32_t credits;  // more calls the client may send
+};
+
+// a payload serialized once to be sent any number of times;
+// the call id in `header` is filled in on each send
+struct EncodedFrame {
+  FrameHeader header{};
+  std::vector<uint8_t> payload;
+};
+
+struct Frame {
+  FrameHeader header;
+  const uint8_t* payload;
+  size_t size;
+  Clock::time_point received;  // when the read that finished it returned
+};
+
+// True if the call is older than its budget.  The age runs
+// from the client's stamp, so it takes in the time the frame
+// sat in socket buffers and behind other frames, not just
+// what it spent with us.  A stamp from the future, i.e. a
+// client clock ahead of ours, counts as no age at all.
+inline bool expired(const Frame& frame, uint32_t now_us = wall_us()) {
+  if (frame.header.budget_us == 0)
+    return false;
+  if (frame.header.sent_us == 0) {
+    // unstamped, so all we know is when we read it
+    std::chrono::microseconds budget{frame.header.budget_us};
+    return Clock::now() - frame.received > budget;
+  }
+  uint32_t age = now_us - frame.header.sent_us;
+  return int32_t(age) > 0 && age > frame.header.budget_us;
+}
+
+// writes all of `iov`, retrying on short writes, and waiting
+// for room if the fd is non-blocking and its buffer is full
+inline void write_fully(int fd, iovec* iov, int count) {
+  while (count > 0) {
+    ssize_t n = ::writev(fd, iov, std::min(count, IOV_MAX));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      pollfd out{fd, POLLOUT, 0};
+      ::poll(&out, 1, -1);
+      continue;
+    }
+    if (n < 0)
+      throw std::system_error(errno, std::generic_category(), "writev");
+    while (count > 0 && size_t(n) >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+// per-thread buffers for (de)compression, reused across frames
+struct Scratch {
+  std::vector<uint8_t> raw;
+  std::vector<uint8_t> packed;
+};
+inline thread_local Scratch scratch;
+
+// writes a frame whose payload is already serialized
+inline void write_raw_frame(int fd, const FrameHeader& header,
+                            const uint8_t* payload, size_t len) {
+  using marshalling::Stream;
+  if (len + sizeof(header) > ~Stream::MASK)
+    throw std::length_error("payload too large for one frame");
+  uint32_t size_header = Stream::TAG | uint32_t(len + sizeof(header));
+  iovec iov[] = {{&size_header, sizeof(size_header)},
+                 {const_cast<FrameHeader*>(&header), sizeof(header)},
+                 {const_cast<uint8_t*>(payload), len}};
+  write_fully(fd, iov, 3);
+}
+
+template <typename Item>
+void write_frame(int fd, const FrameHeader& header, const Item& item,
+                 const FrameOptions& opts = {}) {
+  using marshalling::IOVecOutputStream;
+  if (opts.direct_image && item.has_direct_image()) {
+    marshalling::ByteSize size;
+    item.write_direct(size);
+    if (size.bytes + sizeof(header) > ~marshalling::Stream::MASK)
+      throw std::length_error("item too large for one frame");
+    FrameHeader h = header;
+    h.flags |= FLAG_DIRECT;
+    IOVecOutputStream io;
+    io.write(&h, sizeof(h));
+    item.write_direct(io);
+    write_fully(fd, io.iov(), io.iov_count());
+    return;
+  }
+
+  size_t size = marshalling::byte_size(item);
+  if (size + sizeof(header) > ~marshalling::Stream::MASK)
+    throw std::length_error("item too large for one frame");
+
+  if (opts.compress_threshold && size >= opts.compress_threshold) {
+    auto& raw = scratch.raw;
+    auto& packed = scratch.packed;
+    raw.clear();
+    marshalling::write_item(raw, item);
+    packed.resize(lz::compress_bound(size));
+    size_t n = lz::compress(raw.data(), size, packed.data(), packed.size());
+    if (n > 0 && n < size) {
+      FrameHeader h = header;
+      h.flags |= FLAG_COMPRESSED;
+      h.raw_size = uint16_t(size);
+      write_raw_frame(fd, h, packed.data(), n);
+      return;
+    }
+  }
+
+  IOVecOutputStream io;
+  io.write(&header, sizeof(header));
+  marshalling::ArchiveWriter<IOVecOutputStream> ar{io};
+  ar(item);
+  write_fully(fd, io.iov(), io.iov_count());
+}
+
+// serializes `item` into `out` as a frame payload, compressed
+// if `opts` asks and it helps, and sets the flags in `header`
+// to match.  For payloads kept around to send more than once.
+template <typename Item>
+void encode_payload(const Item& item, const FrameOptions& opts,
+                    FrameHeader& header, std::vector<uint8_t>& out) {
+  out.clear();
+  marshalling::write_item(out, item);
+  size_t size = out.size();
+  if (size + sizeof(header) > ~marshalling::Stream::MASK)
+    throw std::length_error("item too large for one frame");
+  if (opts.compress_threshold && size >= opts.compress_threshold) {
+    auto& packed = scratch.packed;
+    packed.resize(lz::compress_bound(size));
+    size_t n = lz::compress(out.data(), size, packed.data(), packed.size());
+    if (n > 0 && n < size) {
+      header.flags |= FLAG_COMPRESSED;
+      header.raw_size = uint16_t(size);
+      out.assign(packed.begin(), packed.begin() + n);
+    }
+  }
+}
+
+// tells the client `call_id` was dropped without an answer
+inline void write_shed_frame(int fd, uint32_t call_id) {
+  write_raw_frame(fd, make_header(call_id, FLAG_SHED), nullptr, 0);
+}
+
+inline void write_control_frame(int fd, const Control& control) {
+  write_raw_frame(fd, make_header(0, FLAG_CONTROL),
+                  reinterpret_cast<const uint8_t*>(&control), sizeof(control));
+}
+
+// decodes the frame's payload into `item`
+template <typename Item>
+void read_frame(const Frame& frame, Item& item) {
+  if (frame.header.flags & FLAG_COMPRESSED) {
+    auto& raw = scratch.raw;
+    raw.resize(frame.header.raw_size);
+    if (!lz::decompress(frame.payload, frame.size, raw.data(), raw.size()))
+      throw std::out_of_range("corrupt compressed frame");
+    marshalling::read_item(raw.data(), raw.size(), item);
+  } else if (frame.header.flags & FLAG_DIRECT) {
+    item.read_direct(frame.payload, frame.size);
+  } else {
+    marshalling::read_item(frame.payload, frame.size, item);
+  }
+}
+
+// Buffers bytes off of an fd and cuts them into frames.  A
+// frame returned from next() or next_batch() points into our
+// buffer, so it is only valid until the next call.
+//
+// On a non-blocking fd, a read that would block ends the call
+// with what's buffered instead: next() returns false and
+// next_batch() the frames so far, maybe none, and eof() tells
+// that apart from the other end closing.
+class FrameReader {
+ public:
+  static constexpr size_t READ_SIZE = 64 * 1024;
+
+  explicit FrameReader(int fd) : fd_{fd} {}
+
+  // blocks until a whole frame is buffered; false on EOF
+  // (or, non-blocking, if there isn't one yet)
+  bool next(Frame& frame) {
+    using marshalling::Stream;
+    for (;;) {
+      const uint8_t* data = buf_.data() + start_;
+      size_t len = end_ - start_;
+      if (Stream::remaining_bytes(data, len) == 0) {
+        size_t size = Stream::frame_size(data, len);
+        frame = to_frame(data, {0, size});
+        start_ += size;
+        return true;
+      }
+      if (!fill())
+        return false;
+    }
+  }
+
+  // blocks until at least one whole frame is buffered, then
+  // returns all of them at once; empty on EOF (or,
+  // non-blocking, if there isn't one yet).  This is the cheap
+  // way through a burst of small frames.
+  const std::vector<Frame>& next_batch() {
+    using marshalling::Stream;
+    batch_.clear();
+    for (;;) {
+      size_t len = end_ - start_;
+      spans_.resize(len / (Stream::HEADER_SIZE + sizeof(FrameHeader)) + 1);
+      auto r = Stream::index_frames(buf_.data() + start_, len, spans_.data(),
+                                    spans_.size());
+      if (r.bad_tag && r.count == 0)
+        throw std::out_of_range("missing stream boundary tag");
+      if (r.count > 0) {
+        for (size_t i = 0; i < r.count; ++i)
+          batch_.push_back(to_frame(buf_.data() + start_, spans_[i]));
+        start_ += r.consumed;
+        return batch_;
+      }
+      if (!fill())
+        return batch_;
+    }
+  }
+
+  // true once the other end has closed
+  bool eof() const { return eof_; }
+
+ private:
+  Frame to_frame(const uint8_t* data, marshalling::FrameSpan span) const {
+    using marshalling::Stream;
+    if (span.size < Stream::HEADER_SIZE + sizeof(FrameHeader))
+      throw std::out_of_range("rpc frame too small");
+    Frame frame;
+    const uint8_t* start = data + span.offset + Stream::HEADER_SIZE;
+    std::memcpy(&frame.header, start, sizeof(FrameHeader));
+    frame.payload = start + sizeof(FrameHeader);
+    frame.size = span.size - Stream::HEADER_SIZE - sizeof(FrameHeader);
+    frame.received = received_;
+    return frame;
+  }
+
+  bool fill() {
+    // slide the partial frame to the front and top up behind it
+    std::copy(buf_.begin() + start_, buf_.begin() + end_, buf_.begin());
+    end_ -= start_;
+    start_ = 0;
+    if (buf_.size() - end_ < READ_SIZE)
+      buf_.resize(end_ + READ_SIZE);
+
+    ssize_t n;
+    do {
+      n = ::read(fd_, buf_.data() + end_, buf_.size() - end_);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return false;
+    if (n < 0)
+      throw std::system_error(errno, std::generic_category(), "read");
+    end_ += n;
+    received_ = Clock::now();
+    eof_ = n == 0;
+    return n > 0;
+  }
+
+ private:
+  int fd_;
+  std::vector<uint8_t> buf_;
+  size_t start_{0};
+  size_t end_{0};
+  Clock::time_point received_;
+  bool eof_{false};
+  std::vector<marshalling::FrameSpan> spans_;
+  std::vector<Frame> batch_;
+};
+
+// --- --- ENDPOINTS --- --- --- --- --- --- --- ---
+
+template <typename RequestT, typename ResponseT>
+class Client {
+ public:
+  using Callback = std::function<void(ResponseT&)>;
+  using ShedCallback = std::function<void(uint32_t call_id)>;
+
+  explicit Client(int fd) : fd_{fd}, reader_{fd} {}
+
+  // sends the request without waiting for the response, and
+  // returns the id `callback` is filed under.  If the server
+  // has us out of credit, the request is encoded and queued
+  // until it has some.  A nonzero `budget` is how long the
+  // call is worth waiting for, counted from now.
+  uint32_t call(const RequestT& req, Callback callback,
+                std::chrono::microseconds budget = {}) {
+    FrameHeader header = make_header(next_id_++);
+    if (budget.count() == 0)
+      budget = budget_;
+    if (!flow_controlled_ || (pending_.empty() && credits_ > 0)) {
+      header.budget_us = uint32_t(budget.count());
+      if (header.budget_us)
+        header.sent_us = wall_us();
+      write_frame(fd_, header, req, options_);
+      if (flow_controlled_)
+        --credits_;
+    } else {
+      auto& pending = pending_.emplace_back();
+      pending.queued = Clock::now();
+      pending.budget = budget;
+      pending.frame.header = header;
+      encode_payload(req, options_, pending.frame.header,
+                     pending.frame.payload);
+    }
+    calls_.emplace(header.call_id, std::move(callback));
+    return header.call_id;
+  }
+
+  // blocks for one frame from the server and acts on it:
+  // runs a response's callback, or the shed callback, or
+  // takes the credit in a control frame; false on EOF
+  bool poll() {
+    Frame frame;
+    if (!reader_.next(frame))
+      return false;
+    if (frame.header.flags & FLAG_CONTROL) {
+      Control control;
+      if (frame.size != sizeof(control))
+        throw std::out_of_range("bad control frame");
+      std::memcpy(&control, frame.payload, sizeof(control));
+      flow_controlled_ = true;
+      credits_ += control.credits;
+      send_pending();
+      return true;
+    }
+    auto it = calls_.find(frame.header.call_id);
+    if (it == calls_.end())
+      throw std::out_of_range("response for unknown call id");
+    auto callback = std::move(it->second);
+    calls_.erase(it);
+
+    if (frame.header.flags & FLAG_SHED) {
+      shed(frame.header.call_id);
+      return true;
+    }
+    ResponseT resp;
+    read_frame(frame, resp);
+    callback(resp);
+    return true;
+  }
+
+  // polls until every call has been answered or shed
+  bool drain() {
+    while (!calls_.empty())
+      if (!poll())
+        return false;
+    return true;
+  }
+
+  // calls not yet answered, queued ones included
+  size_t outstanding() const { return calls_.size(); }
+  // calls waiting here for credit
+  size_t queued() const { return pending_.size(); }
+  // calls dropped by the server, or here because their budget
+  // ran out while queued
+  size_t shed_count() const { return shed_; }
+
+  // compress requests of at least this many bytes; zero is off
+  void set_compression(size_t threshold) {
+    options_.compress_threshold = threshold;
+  }
+  void set_direct_image(bool on) { options_.direct_image = on; }
+  // Expect the server to set a window, so hold every call
+  // until its credit arrives.  Otherwise calls go straight out
+  // until the first control frame is read.
+  void set_flow_control(bool on) { flow_controlled_ = on; }
+  // the budget for calls which don't give one; zero is none
+  void set_budget(std::chrono::microseconds budget) { budget_ = budget; }
+  // called with the id of each call that's shed
+  void set_shed_callback(ShedCallback callback) {
+    on_shed_ = std::move(callback);
+  }
+
+ private:
+  struct Pending {
+    EncodedFrame frame;
+    Clock::time_point queued;
+    std::chrono::microseconds budget;
+  };
+
+  void send_pending() {
+    auto now = Clock::now();
+    while (credits_ > 0 && !pending_.empty()) {
+      auto& pending = pending_.front();
+      auto& header = pending.frame.header;
+      auto waited = std::chrono::duration_cast<std::chrono::microseconds>(
+          now - pending.queued);
+      auto left = pending.budget - waited;
+      if (pending.budget.count() == 0 || left.count() > 0) {
+        header.budget_us = uint32_t(left.count() > 0 ? left.count() : 0);
+        if (header.budget_us)
+          header.sent_us = wall_us();
+        write_raw_frame(fd_, header, pending.frame.payload.data(),
+                        pending.frame.payload.size());
+        --credits_;
+      } else {
+        calls_.erase(header.call_id);
+        shed(header.call_id);
+      }
+      pending_.pop_front();
+    }
+  }
+
+  void shed(uint32_t call_id) {
+    ++shed_;
+    if (on_shed_)
+      on_shed_(call_id);
+  }
+
+ private:
+  int fd_;
+  FrameReader reader_;
+  FrameOptions options_;
+  uint32_t next_id_{1};
+  std::unordered_map<uint32_t, Callback> calls_;
+  // unlimited until the server sends its first credit
+  bool flow_controlled_{false};
+  uint32_t credits_{0};
+  std::deque<Pending> pending_;
+  std::chrono::microseconds budget_{0};
+  ShedCallback on_shed_;
+  size_t shed_{0};
+};
+
+template <typename RequestT, typename ResponseT>
+class Server {
+ public:
+  explicit Server(int fd) : fd_{fd}, reader_{fd} {}
+
+  // reads one request and calls handler(call_id, request),
+  // unless it's past its budget and is shed; false on EOF
+  template <typename Handler>
+  bool serve(Handler&& handler) {
+    grant();
+    Frame frame;
+    if (!reader_.next(frame))
+      return false;
+    handle(frame, handler);
+    return true;
+  }
+
+  // like serve(), but handles every request that's already
+  // buffered in one go; returns how many, zero on EOF
+  template <typename Handler>
+  size_t serve_batch(Handler&& handler) {
+    grant();
+    auto& frames = reader_.next_batch();
+    for (auto& frame : frames)
+      handle(frame, handler);
+    return frames.size();
+  }
+
+  void respond(uint32_t call_id, const ResponseT& resp) {
+    write_frame(fd_, make_header(call_id), resp, options_);
+    answered();
+  }
+
+  // sends a response which was encoded earlier, as is
+  void respond(uint32_t call_id, const EncodedFrame& encoded) {
+    FrameHeader header = encoded.header;
+    header.call_id = call_id;
+    write_raw_frame(fd_, header, encoded.payload.data(),
+                    encoded.payload.size());
+    answered();
+  }
+
+  // Turns on flow control, letting the client have `window`
+  // calls outstanding with us.  Call it before serving; the
+  // window can be grown later but not shrunk.
+  void set_window(uint32_t window) {
+    if (window > window_) {
+      write_control_frame(fd_, Control{window - window_});
+      window_ = window;
+    }
+  }
+
+  // compress responses of at least this many bytes; zero is off
+  void set_compression(size_t threshold) {
+    options_.compress_threshold = threshold;
+  }
+  void set_direct_image(bool on) { options_.direct_image = on; }
+  const FrameOptions& options() const { return options_; }
+
+  // records every request served into `out`; nullptr stops
+  void set_capture(capture::CaptureWriter* out) { capture_ = out; }
+
+  // requests read but not yet answered
+  size_t queue_depth() const { return in_flight_; }
+  // requests dropped for being past their budget
+  size_t shed_count() const { return shed_; }
+
+ private:
+  template <typename Handler>
+  void handle(const Frame& frame, Handler& handler) {
+    ++in_flight_;
+    if (expired(frame)) {
+      write_shed_frame(fd_, frame.header.call_id);
+      ++shed_;
+      answered();
+      return;
+    }
+    RequestT req;
+    read_frame(frame, req);
+    if (capture_)
+      capture_->append(req);
+    handler(frame.header.call_id, req);
+  }
+
+  // credit goes back in batches of a quarter window, and
+  // whatever is left over before we block on a read
+  void answered() {
+    --in_flight_;
+    if (window_ && ++ungranted_ >= std::max(1u, window_ / 4))
+      grant();
+  }
+  void grant() {
+    if (ungranted_) {
+      write_control_frame(fd_, Control{ungranted_});
+      ungranted_ = 0;
+    }
+  }
+
+ private:
+  int fd_;
+  FrameReader reader_;
+  FrameOptions options_;
+  capture::CaptureWriter* capture_{nullptr};
+  uint32_t window_{0};  // zero is no flow control
+  uint32_t ungranted_{0};
+  size_t in_flight_{0};
+  size_t shed_{0};
+};
+
+}  // namespace rpc
+}  // namespace darr
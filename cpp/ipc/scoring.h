@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "api.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DARR_SCORING_AVX2 1
+#endif
+
+//
+// Ranks the providers in a SomeRequest and fills the answers
+// of a SomeResponse with the best of them.
+//
+//     scoring::ScoreTable table{markets, providers};
+//     table.set(market, provider, score);
+//     table.set_weight(provider, weight);
+//
+//     scoring::rank_providers(req, table, 3, resp);
+//
+// A provider's score is the dense table entry for the request's
+// market times the provider's weight.  Provider ids are first
+// pulled out of the request into a flat array, so scoring is
+// a gather over two tables, eight at a time with AVX2.  Then
+// top-k is a running threshold, and again with AVX2 a block of
+// eight that can't beat it is skipped with one compare.
+//
+// The AVX2 code is compiled for x86-64 regardless of -march
+// and used if the CPU has it; otherwise it's the scalar code.
+//
+
+namespace darr {
+namespace scoring {
+
+class ScoreTable {
+ public:
+  ScoreTable(size_t markets, size_t providers)
+      : markets_{markets},
+        providers_{providers},
+        scores_(markets * providers),
+        weights_(providers, 1.0f) {}
+
+  void set(uint32_t market, uint32_t provider, float score) {
+    if (market >= markets_ || provider >= providers_)
+      throw std::out_of_range("score table");
+    scores_[market * providers_ + provider] = score;
+  }
+  void set_weight(uint32_t provider, float weight) {
+    if (provider >= providers_)
+      throw std::out_of_range("score table");
+    weights_[provider] = weight;
+  }
+
+  // the scores for a market; nullptr if it's not in the table
+  const float* row(uint32_t market) const {
+    return market < markets_ ? &scores_[market * providers_] : nullptr;
+  }
+  const float* weights() const { return weights_.data(); }
+  size_t providers() const { return providers_; }
+
+ private:
+  size_t markets_;
+  size_t providers_;
+  std::vector<float> scores_;
+  std::vector<float> weights_;
+};
+
+namespace detail {
+// Unknown provider ids score -inf and are never chosen
+
+inline void score_scalar(const float* row, const float* weights,
+                         uint32_t providers, const uint32_t* ids, size_t n,
+                         float* out) {
+  for (size_t i = 0; i < n; ++i)
+    out[i] = ids[i] < providers ? row[ids[i]] * weights[ids[i]] : -INFINITY;
+}
+
+// keeps the best `k` in `best`, best first; ties go to the earlier
+struct TopK {
+  uint32_t* best;
+  float* best_scores;
+  size_t k;
+  size_t count{0};
+
+  float threshold() const {
+    return count < k ? -INFINITY : best_scores[count - 1];
+  }
+  void offer(uint32_t index, float score) {
+    if (!(score > threshold()))
+      return;
+    size_t pos = count < k ? count++ : k - 1;
+    for (; pos > 0 && best_scores[pos - 1] < score; --pos) {
+      best[pos] = best[pos - 1];
+      best_scores[pos] = best_scores[pos - 1];
+    }
+    best[pos] = index;
+    best_scores[pos] = score;
+  }
+};
+
+inline void top_k_scalar(const float* scores, size_t n, TopK& top) {
+  for (size_t i = 0; i < n; ++i)
+    top.offer(i, scores[i]);
+}
+
+#ifdef DARR_SCORING_AVX2
+__attribute__((target("avx2"))) inline void score_avx2(
+    const float* row, const float* weights, uint32_t providers,
+    const uint32_t* ids, size_t n, float* out) {
+  const __m256 neg_inf = _mm256_set1_ps(-INFINITY);
+  const __m256i limit = _mm256_set1_epi32(int32_t(providers));
+  const __m256i minus_one = _mm256_set1_epi32(-1);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ids + i));
+    // ids are unsigned, so check both ends as signed
+    __m256 ok = _mm256_castsi256_ps(
+        _mm256_and_si256(_mm256_cmpgt_epi32(limit, idx),
+                         _mm256_cmpgt_epi32(idx, minus_one)));
+    __m256 s = _mm256_mask_i32gather_ps(neg_inf, row, idx, ok, 4);
+    __m256 w = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), weights, idx, ok,
+                                        4);
+    _mm256_storeu_ps(out + i, _mm256_blendv_ps(neg_inf, _mm256_mul_ps(s, w), ok));
+  }
+  score_scalar(row, weights, providers, ids + i, n - i, out + i);
+}
+
+__attribute__((target("avx2"))) inline void top_k_avx2(const float* scores,
+                                                       size_t n, TopK& top) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(scores + i);
+    __m256 thr = _mm256_set1_ps(top.threshold());
+    unsigned mask = _mm256_movemask_ps(_mm256_cmp_ps(v, thr, _CMP_GT_OQ));
+    for (; mask; mask &= mask - 1) {
+      unsigned lane = __builtin_ctz(mask);
+      top.offer(i + lane, scores[i + lane]);
+    }
+  }
+  for (; i < n; ++i)
+    top.offer(i, scores[i]);
+}
+
+inline bool has_avx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+#endif
+
+inline void score(const float* row, const float* weights, uint32_t providers,
+                  const uint32_t* ids, size_t n, float* out) {
+#ifdef DARR_SCORING_AVX2
+  if (has_avx2())
+    return score_avx2(row, weights, providers, ids, n, out);
+#endif
+  score_scalar(row, weights, providers, ids, n, out);
+}
+
+inline void top_k(const float* scores, size_t n, TopK& top) {
+#ifdef DARR_SCORING_AVX2
+  if (has_avx2())
+    return top_k_avx2(scores, n, top);
+#endif
+  top_k_scalar(scores, n, top);
+}
+
+// per-thread struct-of-arrays buffers, reused across requests
+struct Scratch {
+  std::vector<uint32_t> ids;
+  std::vector<float> scores;
+  std::vector<uint32_t> best;
+  std::vector<float> best_scores;
+};
+inline thread_local Scratch scratch;
+}  // namespace detail
+
+// Appends the `k` best providers in `req` to `resp.answers`,
+// best first, and returns how many.  Providers whose id isn't
+// in the table are skipped, as is everything if the market isn't.
+inline size_t rank_providers(const SomeRequest& req, const ScoreTable& table,
+                             size_t k, SomeResponse& resp) {
+  const float* row = table.row(req.location.market);
+  if (!row || k == 0)
+    return 0;
+
+  auto& s = detail::scratch;
+  size_t n = req.providers.size();
+  s.ids.resize(n);
+  s.scores.resize(n);
+  for (size_t i = 0; i < n; ++i)
+    s.ids[i] = req.providers[i].id;
+  detail::score(row, table.weights(), table.providers(), s.ids.data(), n,
+                s.scores.data());
+
+  s.best.resize(k);
+  s.best_scores.resize(k);
+  detail::TopK top{s.best.data(), s.best_scores.data(), k};
+  detail::top_k(s.scores.data(), n, top);
+
+  for (size_t i = 0; i < top.count; ++i) {
+    auto& answer = resp.answers.emplace_back();
+    answer.answer = *req.providers[top.best[i]].name;
+    answer.ok = true;
+  }
+  return top.count;
+}
+
+}  // namespace scoring
+}  // namespace darr
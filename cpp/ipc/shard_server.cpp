@@ -0,0 +1,221 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "api.h"
+#include "histogram.h"
+#include "shard_server.h"
+
+//
+// Runs a thread-per-core ShardedServer, and by default loads
+// it from this process and reports how it scaled.
+//
+//     shard_server [--cores N] [--connections N] [--depth N]
+//                  [--seconds N] [--sweep] [--no-pin]
+//     shard_server --serve --port P [--cores N]
+//
+// The load comes from --connections loopback clients (four
+// per core by default), each a thread keeping --depth calls
+// in flight.  Per-core QPS is from the server's own counters;
+// latency is measured by the clients, send to response.
+// --sweep repeats the run for 1, 2, ... up to --cores cores to
+// show whether throughput grows with them.  The clients share
+// the machine, so leave cores free for them when it matters.
+//
+// --serve skips the load and just serves on --port until
+// killed, for replay --connect or another box to drive.
+//
+
+namespace darr {
+namespace {
+using Clock = std::chrono::steady_clock;
+using Server = rpc::ShardedServer<SomeRequest, SomeResponse>;
+
+struct Options {
+  size_t cores{std::max(1u, std::thread::hardware_concurrency())};
+  size_t connections{0};
+  size_t depth{4};
+  double seconds{3};
+  uint16_t port{0};
+  bool sweep{false};
+  bool serve{false};
+  bool pin{true};
+};
+
+void usage() {
+  std::cerr << "usage: shard_server [--cores N] [--connections N] "
+               "[--depth N] [--seconds N] [--sweep] [--no-pin]\n"
+               "       shard_server --serve --port P [--cores N]\n";
+  exit(2);
+}
+
+Options parse_args(int argc, char** argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--cores" && has_value) {
+      opts.cores = std::stoul(argv[++i]);
+    } else if (arg == "--connections" && has_value) {
+      opts.connections = std::stoul(argv[++i]);
+    } else if (arg == "--depth" && has_value) {
+      opts.depth = std::stoul(argv[++i]);
+    } else if (arg == "--seconds" && has_value) {
+      opts.seconds = std::stod(argv[++i]);
+    } else if (arg == "--port" && has_value) {
+      opts.port = uint16_t(std::stoul(argv[++i]));
+    } else if (arg == "--sweep") {
+      opts.sweep = true;
+    } else if (arg == "--serve") {
+      opts.serve = true;
+    } else if (arg == "--no-pin") {
+      opts.pin = false;
+    } else {
+      usage();
+    }
+  }
+  if (opts.cores == 0 || opts.depth == 0 || (opts.serve && opts.port == 0))
+    usage();
+  return opts;
+}
+
+// answers with the query method, so there's a string each way
+void handle(const SomeRequest& req, SomeResponse& resp) {
+  resp.response.ttl = 60;
+  auto& answer = resp.answers.emplace_back();
+  answer.answer = *req.query.method;
+  answer.ok = true;
+}
+
+int connect_loopback(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr),
+                        sizeof(addr)) != 0) {
+    perror("shard_server: connect");
+    exit(1);
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+// one connection with `depth` calls in flight until `until`
+void client(uint16_t port, size_t depth, Clock::time_point until,
+            Histogram& latency) {
+  int fd = connect_loopback(port);
+  rpc::Client<SomeRequest, SomeResponse> conn{fd};
+  std::function<void()> send = [&] {
+    SomeRequest req;
+    req.query.method = "A";
+    req.location.market = 1;
+    auto start = Clock::now();
+    conn.call(req, [&, start](SomeResponse&) {
+      auto now = Clock::now();
+      latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         now - start)
+                         .count());
+      if (now < until)
+        send();
+    });
+  };
+  for (size_t i = 0; i < depth; ++i)
+    send();
+  conn.drain();
+  close(fd);
+}
+
+struct Result {
+  double seconds;
+  std::vector<uint64_t> per_core;
+  Histogram latency;
+};
+
+Result load(const Options& opts, size_t cores) {
+  Server::Options server_opts;
+  server_opts.cores = cores;
+  server_opts.pin = opts.pin;
+  server_opts.loopback = true;
+  Server server{server_opts, handle};
+
+  size_t connections = opts.connections ? opts.connections : 4 * cores;
+  std::vector<Histogram> latencies(connections);
+  std::vector<std::thread> clients;
+  auto start = Clock::now();
+  auto until = start + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(opts.seconds));
+  for (size_t i = 0; i < connections; ++i)
+    clients.emplace_back(client, server.port(), opts.depth, until,
+                         std::ref(latencies[i]));
+  for (auto& t : clients)
+    t.join();
+
+  Result result;
+  result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  for (size_t core = 0; core < server.cores(); ++core)
+    result.per_core.push_back(server.stats(core).requests);
+  for (auto& h : latencies)
+    result.latency.merge(h);
+  server.stop();
+  return result;
+}
+
+void report(const Result& r) {
+  uint64_t total = 0;
+  for (size_t core = 0; core < r.per_core.size(); ++core) {
+    total += r.per_core[core];
+    std::printf("  core %-3zu %12.0f qps\n", core, r.per_core[core] / r.seconds);
+  }
+  std::printf("  total    %12.0f qps\n", total / r.seconds);
+  std::printf("  latency  p50 %.1fus  p99 %.1fus  p999 %.1fus  max %.1fus\n",
+              r.latency.percentile(50) / 1e3, r.latency.percentile(99) / 1e3,
+              r.latency.percentile(99.9) / 1e3, r.latency.max() / 1e3);
+}
+
+int run(const Options& opts) {
+  if (opts.serve) {
+    Server::Options server_opts;
+    server_opts.port = opts.port;
+    server_opts.cores = opts.cores;
+    server_opts.pin = opts.pin;
+    Server server{server_opts, handle};
+    std::cout << "serving on port " << server.port() << " with "
+              << server.cores() << " cores\n";
+    for (;;)
+      pause();
+  }
+
+  double base = 0;
+  for (size_t cores = opts.sweep ? 1 : opts.cores; cores <= opts.cores;
+       ++cores) {
+    Result r = load(opts, cores);
+    uint64_t total = 0;
+    for (auto n : r.per_core)
+      total += n;
+    double qps = total / r.seconds;
+    if (base == 0)
+      base = qps / cores;
+    std::printf("%zu core%s: %.2fx of linear\n", cores, cores > 1 ? "s" : "",
+                qps / (base * cores));
+    report(r);
+  }
+  return 0;
+}
+}  // namespace
+}  // namespace darr
+
+int main(int argc, char** argv) {
+  return darr::run(darr::parse_args(argc, argv));
+}
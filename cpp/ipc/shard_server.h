@@ -0,0 +1,260 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <functional>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "rpc.h"
+
+//
+// A thread-per-core rpc server.  Each core gets its own
+// SO_REUSEPORT listening socket on the same port, its own
+// thread pinned to it, and runs accept, read, decode, handle,
+// encode and write for its connections start to finish.  The
+// kernel spreads connections across the sockets, so nothing
+// is handed between cores.
+//
+//     rpc::ShardedServer<SomeRequest, SomeResponse>::Options opts;
+//     opts.port = 5300;
+//     rpc::ShardedServer<SomeRequest, SomeResponse> server{
+//         opts, [](const SomeRequest& req, SomeResponse& resp) {
+//           ...
+//         }};
+//     ...
+//     server.stop();
+//
+// Each worker decodes into one request and encodes from one
+// response that live on its own stack for its whole life, so
+// there's no allocation per call and the one-instance-per-
+// thread rule for SerializedType holds.  Counters are kept per
+// core, a cache line each.
+//
+// Connections are non-blocking, so a partial frame waits in
+// its connection's buffer for the rest while the core serves
+// the others.  Writes still wait for room, so a client that
+// stops reading its responses holds up its core.
+//
+// Requests which carry a budget and are older than it by the
+// time they're read are shed, as with Server.  There's no
+// flow control window here; each core only holds what one
+// read brings in.
+//
+// Pinning is Linux only.  Elsewhere the threads float, and
+// SO_REUSEPORT may not balance, e.g. macOS gives every
+// connection to the last socket bound.
+//
+
+namespace darr {
+namespace rpc {
+
+template <typename RequestT, typename ResponseT>
+class ShardedServer {
+ public:
+  using Handler = std::function<void(const RequestT&, ResponseT&)>;
+
+  struct Options {
+    uint16_t port{0};   // zero picks a free one; see port()
+    size_t cores{0};    // zero is one per hardware thread
+    bool pin{true};     // pin worker i to cpu i
+    bool loopback{false};
+    FrameOptions frame;  // how responses are written
+  };
+
+  struct alignas(64) CoreStats {
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> connections{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> shed{0};  // past their budget when read
+  };
+
+  ShardedServer(const Options& opts, Handler handler)
+      : opts_{opts}, handler_{std::move(handler)} {
+    size_t cores = opts_.cores;
+    if (cores == 0)
+      cores = std::max(1u, std::thread::hardware_concurrency());
+    port_ = opts_.port;
+    for (size_t core = 0; core < cores; ++core) {
+      listen_fds_.push_back(listen_on(port_));
+      stats_.emplace_back(new CoreStats);
+    }
+    for (size_t core = 0; core < cores; ++core)
+      workers_.emplace_back([this, core] { run(core); });
+  }
+  ShardedServer(const ShardedServer&) = delete;
+  ~ShardedServer() { stop(); }
+
+  // waits for the workers to finish what they've read and exit
+  void stop() {
+    stopping_ = true;
+    for (auto& worker : workers_)
+      if (worker.joinable())
+        worker.join();
+    for (int fd : listen_fds_)
+      ::close(fd);
+    listen_fds_.clear();
+  }
+
+  uint16_t port() const { return port_; }
+  size_t cores() const { return stats_.size(); }
+  const CoreStats& stats(size_t core) const { return *stats_[core]; }
+
+ private:
+  // binds a listening socket to `port`, and sets `port` to the
+  // one bound if it was zero, so the next socket shares it
+  int listen_on(uint16_t& port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), "socket");
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0)
+      fail(fd, "SO_REUSEPORT");
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(opts_.loopback ? INADDR_LOOPBACK : INADDR_ANY);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+      fail(fd, "bind");
+    if (::listen(fd, SOMAXCONN) != 0)
+      fail(fd, "listen");
+    socklen_t len = sizeof(addr);
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    port = ntohs(addr.sin_port);
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+  }
+
+  [[noreturn]] void fail(int fd, const char* what) {
+    int err = errno;
+    ::close(fd);
+    for (int open : listen_fds_)
+      ::close(open);
+    throw std::system_error(err, std::generic_category(), what);
+  }
+
+  static void pin_to(size_t core) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % CPU_SETSIZE, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)core;
+#endif
+  }
+
+  struct Connection {
+    int fd;
+    FrameReader reader;
+  };
+
+  void run(size_t core) {
+    if (opts_.pin)
+      pin_to(core);
+    CoreStats& stats = *stats_[core];
+    Handler handler = handler_;  // a copy of our own
+    RequestT req;
+    ResponseT resp;
+
+    // slot 0 is the listening socket; the rest line up with conns
+    std::vector<pollfd> fds{{listen_fds_[core], POLLIN, 0}};
+    std::vector<std::unique_ptr<Connection>> conns;
+    while (!stopping_) {
+      if (::poll(fds.data(), fds.size(), 50) <= 0)
+        continue;
+      if (fds[0].revents & POLLIN)
+        accept_all(fds, conns, stats);
+      for (size_t i = 1; i < fds.size(); ++i) {
+        if (!fds[i].revents)
+          continue;
+        auto& conn = *conns[i - 1];
+        if (!serve(conn, req, resp, handler, stats)) {
+          ::close(conn.fd);
+          fds[i].fd = -1;
+        }
+      }
+      for (size_t i = fds.size(); i-- > 1;) {
+        if (fds[i].fd < 0) {
+          fds.erase(fds.begin() + i);
+          conns.erase(conns.begin() + (i - 1));
+        }
+      }
+    }
+    for (auto& conn : conns)
+      ::close(conn->fd);
+  }
+
+  void accept_all(std::vector<pollfd>& fds,
+                  std::vector<std::unique_ptr<Connection>>& conns,
+                  CoreStats& stats) {
+    for (;;) {
+      int fd = ::accept(fds[0].fd, nullptr, nullptr);
+      if (fd < 0)
+        return;
+      int one = 1;
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      // so a client that sends half a frame can't stall the core
+      ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+      fds.push_back({fd, POLLIN, 0});
+      conns.emplace_back(new Connection{fd, FrameReader{fd}});
+      ++stats.connections;
+    }
+  }
+
+  // handles whatever whole frames the connection has ready;
+  // false once it's closed or sent something we can't decode
+  bool serve(Connection& conn, RequestT& req, ResponseT& resp,
+             Handler& handler, CoreStats& stats) {
+    try {
+      auto& frames = conn.reader.next_batch();
+      if (frames.empty())
+        return !conn.reader.eof();
+      uint32_t now = wall_us();
+      size_t handled = 0;
+      for (auto& frame : frames) {
+        if (expired(frame, now)) {
+          write_shed_frame(conn.fd, frame.header.call_id);
+          ++stats.shed;
+          continue;
+        }
+        read_frame(frame, req);
+        resp.clear();
+        handler(req, resp);
+        write_frame(conn.fd, make_header(frame.header.call_id), resp,
+                    opts_.frame);
+        ++handled;
+      }
+      stats.requests.fetch_add(handled, std::memory_order_relaxed);
+      return true;
+    } catch (const std::exception&) {
+      ++stats.errors;
+      return false;
+    }
+  }
+
+ private:
+  Options opts_;
+  Handler handler_;
+  uint16_t port_{0};
+  std::vector<int> listen_fds_;
+  std::vector<std::unique_ptr<CoreStats>> stats_;
+  std::vector<std::thread> workers_;
+  std::atomic<bool> stopping_{false};
+};
+
+}  // namespace rpc
+}  // namespace darr
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <stdexcept>
 #include <variant>
 #include <vector>
 
@@ -54,11 +55,11 @@ class small_vector {
   }
   value_type& back() {
     return std::visit(
-        [&](auto& d) -> auto& { return d[size_]; }, data_);
+        [&](auto& d) -> auto& { return d[size_ - 1]; }, data_);
   }
   const value_type& back() const {
     return std::visit(
-        [&](auto& d) -> auto& { return d[size_]; }, data_);
+        [&](auto& d) -> auto& { return d[size_ - 1]; }, data_);
   }
 
   // == insert individual values
@@ -68,15 +69,14 @@ class small_vector {
   template <typename... ArgTs>
   value_type& emplace_back(ArgTs&&... v) {
     auto n = size_;
-    ++size_;
-    if (is_stack() && size_ < N) {
+    if (is_stack() && n + 1 < N) {
+      ++size_;
       return (stack()[n] = T{std::forward<ArgTs>(v)...});
     } else if (is_stack()) {
       convert_to_heap();
-      return heap().emplace_back(std::forward<ArgTs>(v)...);
-    } else {
-      return heap().emplace_back(std::forward<ArgTs>(v)...);
     }
+    ++size_;
+    return heap().emplace_back(std::forward<ArgTs>(v)...);
   }
 
   // == range insertion
@@ -122,10 +122,11 @@ class small_vector {
   stack_type& stack() { return std::get<stack_type>(data_); }
   heap_type& heap() { return std::get<heap_type>(data_); }
 
+  // moves the live elements, [0, size_), to the heap
   void convert_to_heap() {
     auto& s = stack();
     heap_type vec{std::make_move_iterator(s.begin()),
-                  std::make_move_iterator(s.end())};
+                  std::make_move_iterator(s.begin() + size_)};
     data_ = std::move(vec);
   }
 
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/*
+ * Counts every heap allocation the program makes, so a test
+ * or benchmark can check a path allocates nothing:
+ *
+ *     size_t before = darr::allocations;
+ *     parse_person(view, line);
+ *     darr::allocations - before;  // allocations since
+ *
+ * It replaces the global operator new and delete, which can't
+ * be inline, so include it in one file of a program only.
+ */
+
+namespace darr {
+inline std::atomic<size_t> allocations{0};
+}  // namespace darr
+
+void* operator new(size_t size) {
+  ++darr::allocations;
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+// out of line, or g++ sees free() take what `new` returned
+// and warns (-Wmismatched-new-delete)
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
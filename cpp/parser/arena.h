@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/*
+ * Somewhere to copy segments to when the text they came from
+ * won't outlive the target.  Copies are packed into blocks,
+ * which are only freed with the arena; clear() keeps them to
+ * reuse, so a parse loop allocates nothing once it's warm.
+ *
+ *     StringArena arena;
+ *     parse_person(view, line, arena);  // view's strings live in arena
+ *     ...
+ *     arena.clear();                    // and are gone
+ */
+
+namespace darr {
+
+class StringArena {
+ public:
+  explicit StringArena(size_t block_size = 4096) : block_size_{block_size} {}
+  StringArena(const StringArena&) = delete;
+  StringArena& operator=(const StringArena&) = delete;
+
+  // a copy of `s` that lives until clear()
+  std::string_view copy(std::string_view s) {
+    if (s.empty())
+      return {};
+    if (s.size() > left_)
+      next_block(s.size());
+    char* at = pos_;
+    std::memcpy(at, s.data(), s.size());
+    pos_ += s.size();
+    left_ -= s.size();
+    return {at, s.size()};
+  }
+
+  // forgets every copy, keeping the memory
+  void clear() {
+    current_ = 0;
+    pos_ = nullptr;
+    left_ = 0;
+    used_ = 0;
+    if (!blocks_.empty())
+      start_block(0);
+  }
+
+  size_t used() const { return used_ + (blocks_.empty() ? 0 : taken()); }
+  size_t reserved() const {
+    size_t n = 0;
+    for (auto& b : blocks_)
+      n += b.size;
+    return n;
+  }
+
+ private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  size_t taken() const { return blocks_[current_].size - left_; }
+
+  void start_block(size_t i) {
+    current_ = i;
+    pos_ = blocks_[i].data.get();
+    left_ = blocks_[i].size;
+  }
+
+  // moves on to a block with room for `n`, reusing one
+  // kept by clear() if it's big enough
+  void next_block(size_t n) {
+    if (pos_)
+      used_ += taken();
+    for (size_t i = pos_ ? current_ + 1 : 0; i < blocks_.size(); ++i) {
+      if (blocks_[i].size >= n) {
+        // a kept block too small for this string is skipped
+        // for good until the next clear(), which is fine
+        start_block(i);
+        return;
+      }
+    }
+    size_t size = std::max(n, block_size_);
+    blocks_.push_back(Block{std::unique_ptr<char[]>(new char[size]), size});
+    start_block(blocks_.size() - 1);
+  }
+
+  size_t block_size_;
+  std::vector<Block> blocks_;
+  size_t current_{0};
+  char* pos_{nullptr};
+  size_t left_{0};
+  size_t used_{0};  // in blocks before the current one
+};
+
+}  // namespace darr
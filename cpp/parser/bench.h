@@ -0,0 +1,235 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Pieces of the parser benchmark: corpora made to order from
+ * a description of a grammar's segments, and the CPU's own
+ * counters around a loop.
+ *
+ *     CorpusSpec spec;
+ *     spec.prefix = "/";
+ *     spec.segments = {text(3, 12), text(3, 12), number(0, 120, 0.8)};
+ *     spec.fail_ratio = 0.1;
+ *     Corpus corpus = generate(spec);  // the same for the same seed
+ *
+ *     Counters counters;
+ *     counters.start();
+ *     for (auto record : corpus.records) ...
+ *     auto sample = counters.stop();
+ */
+
+namespace darr {
+namespace bench {
+
+// one segment of a record
+struct Segment {
+  bool number{false};
+  size_t min_length{1}, max_length{8};  // text
+  uint64_t min_value{0}, max_value{0};  // numbers
+  double present{1};                    // less than 1 if optional
+  std::string key;                      // "key=" goes first, if set
+};
+
+inline Segment text(size_t min_length, size_t max_length,
+                    double present = 1) {
+  Segment s;
+  s.min_length = min_length;
+  s.max_length = max_length;
+  s.present = present;
+  return s;
+}
+inline Segment number(uint64_t min_value, uint64_t max_value,
+                      double present = 1) {
+  Segment s;
+  s.number = true;
+  s.min_value = min_value;
+  s.max_value = max_value;
+  s.present = present;
+  return s;
+}
+inline Segment keyed(std::string key, Segment s) {
+  s.key = std::move(key);
+  return s;
+}
+
+struct CorpusSpec {
+  std::string prefix{"/"};
+  char delimiter{'/'};
+  std::vector<Segment> segments;
+  double fail_ratio{0};  // the share of records broken on purpose
+  size_t records{100000};
+  uint64_t seed{1};
+};
+
+struct Corpus {
+  std::string text;  // the records, a line each
+  std::vector<std::string_view> records;
+  size_t broken{0};
+  size_t bytes{0};  // in records, without newlines
+};
+
+// Records per the spec.  A broken one either stops short of
+// a required segment or has letters in a number, so it fails
+// any grammar that the spec describes
+inline Corpus generate(const CorpusSpec& spec) {
+  std::mt19937_64 rng{spec.seed};
+  std::uniform_real_distribution<double> roll;
+  auto between = [&](uint64_t lo, uint64_t hi) {
+    return lo + (hi > lo ? rng() % (hi - lo + 1) : 0);
+  };
+
+  std::vector<size_t> required, numbers;
+  for (size_t i = 0; i < spec.segments.size(); ++i) {
+    if (spec.segments[i].present >= 1)
+      required.push_back(i);
+    if (spec.segments[i].number)
+      numbers.push_back(i);
+  }
+
+  Corpus corpus;
+  std::vector<size_t> offsets;
+  for (size_t r = 0; r < spec.records; ++r) {
+    bool broken = roll(rng) < spec.fail_ratio &&
+                  !(required.empty() && numbers.empty());
+    size_t stop = spec.segments.size(), bad = SIZE_MAX;
+    if (broken) {
+      bool truncate = numbers.empty() || (!required.empty() && rng() % 2);
+      if (truncate)
+        stop = required[rng() % required.size()];
+      else
+        bad = numbers[rng() % numbers.size()];
+    }
+
+    offsets.push_back(corpus.text.size());
+    corpus.text += spec.prefix;
+    bool first = true;
+    for (size_t i = 0; i < stop; ++i) {
+      const Segment& s = spec.segments[i];
+      if (i != bad && s.present < 1 && roll(rng) >= s.present)
+        continue;
+      if (!first)
+        corpus.text += spec.delimiter;
+      first = false;
+      if (!s.key.empty())
+        corpus.text += s.key + "=";
+      if (i == bad) {
+        corpus.text += "x" + std::to_string(between(0, 999));
+      } else if (s.number) {
+        corpus.text += std::to_string(between(s.min_value, s.max_value));
+      } else {
+        for (size_t n = between(s.min_length, s.max_length); n; --n)
+          corpus.text += char('a' + rng() % 26);
+      }
+    }
+    corpus.text += '\n';
+    corpus.broken += broken;
+  }
+
+  // views once the text has stopped moving
+  for (size_t r = 0; r < offsets.size(); ++r) {
+    size_t end = (r + 1 < offsets.size() ? offsets[r + 1] : corpus.text.size());
+    corpus.records.emplace_back(corpus.text.data() + offsets[r],
+                                end - offsets[r] - 1);
+    corpus.bytes += end - offsets[r] - 1;
+  }
+  return corpus;
+}
+
+// Cycles, branches and branch misses for this thread, from
+// perf events; where those aren't allowed (a VM, or
+// perf_event_paranoid), cycles are TSC ticks and there are no
+// branch counts
+class Counters {
+ public:
+  struct Sample {
+    uint64_t cycles{0};
+    uint64_t branches{0};
+    uint64_t misses{0};
+    bool tsc{false};  // cycles are TSC ticks
+    bool has_branches{false};
+  };
+
+  Counters() {
+    leader_ = open(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (leader_ < 0)
+      return;
+    branches_ = open(PERF_COUNT_HW_BRANCH_INSTRUCTIONS, leader_);
+    misses_ = open(PERF_COUNT_HW_BRANCH_MISSES, leader_);
+  }
+  Counters(const Counters&) = delete;
+  ~Counters() {
+    for (int fd : {misses_, branches_, leader_})
+      if (fd >= 0)
+        ::close(fd);
+  }
+
+  void start() {
+    if (leader_ >= 0) {
+      ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    tsc_ = ticks();
+  }
+
+  Sample stop() {
+    Sample s;
+    uint64_t tsc = ticks() - tsc_;
+    if (leader_ >= 0) {
+      ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      s.cycles = read_count(leader_);
+      s.has_branches = branches_ >= 0 && misses_ >= 0;
+      if (s.has_branches) {
+        s.branches = read_count(branches_);
+        s.misses = read_count(misses_);
+      }
+    }
+    if (s.cycles == 0) {
+      s.cycles = tsc;
+      s.tsc = true;
+    }
+    return s;
+  }
+
+ private:
+  static int open(uint64_t config, int group) {
+    perf_event_attr attr{};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return int(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+  }
+  static uint64_t read_count(int fd) {
+    uint64_t v = 0;
+    return ::read(fd, &v, sizeof(v)) == sizeof(v) ? v : 0;
+  }
+  static uint64_t ticks() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+  }
+
+  int leader_{-1}, branches_{-1}, misses_{-1};
+  uint64_t tsc_{0};
+};
+
+}  // namespace bench
+}  // namespace darr
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Runs a parse over a large newline-delimited file on every
+ * core.
+ *
+ *     MappedFile file{path};
+ *     auto counts = parse_chunks(file.text(), [](std::string_view chunk) {
+ *       size_t n = 0;
+ *       for_each_line(chunk, [&](std::string_view line) { ... });
+ *       return n;
+ *     });
+ *
+ * The text is cut into chunks of about opts.chunk_size that end
+ * on a newline, so no line is split.  Each thread starts on
+ * its own run of chunks in order and, when it runs out,
+ * steals the back half of whatever run has the most left.
+ * Results come back in chunk order, whichever thread made
+ * them, so merging them keeps file order.
+ */
+
+namespace darr {
+
+// a read-only mapping of a whole file
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      int err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::generic_category(), path);
+    }
+    size_ = st.st_size;
+    if (size_ > 0) {
+      void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+      }
+      data_ = static_cast<const char*>(p);
+      ::madvise(p, size_, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+  }
+  MappedFile(const MappedFile&) = delete;
+  ~MappedFile() {
+    if (data_)
+      ::munmap(const_cast<char*>(data_), size_);
+  }
+
+  std::string_view text() const { return {data_, size_}; }
+
+ private:
+  const char* data_{nullptr};
+  size_t size_{0};
+};
+
+// calls fn(line) for each line, without its newline
+template <typename Fn>
+void for_each_line(std::string_view text, Fn&& fn) {
+  const char* p = text.data();
+  const char* end = p + text.size();
+  while (p < end) {
+    auto* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    if (!eol)
+      eol = end;
+    fn(std::string_view{p, size_t(eol - p)});
+    p = eol + 1;
+  }
+}
+
+// cuts `text` into pieces of about `size` bytes which end
+// just after a newline (or at the end of the text)
+inline std::vector<std::string_view> split_chunks(std::string_view text,
+                                                  size_t size) {
+  std::vector<std::string_view> chunks;
+  size = std::max<size_t>(size, 1);
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = std::min(start + size, text.size());
+    if (end < text.size()) {
+      end = text.find('\n', end - 1);
+      end = end == std::string_view::npos ? text.size() : end + 1;
+    }
+    chunks.push_back(text.substr(start, end - start));
+    start = end;
+  }
+  return chunks;
+}
+
+namespace detail {
+// A run of task indexes [begin, end) packed in one word, so
+// the owner taking from the front and a thief cutting off the
+// back are each a single compare-and-swap
+struct alignas(64) TaskRange {
+  std::atomic<uint64_t> span{0};
+
+  static uint64_t pack(uint32_t begin, uint32_t end) {
+    return uint64_t(end) << 32 | begin;
+  }
+  static uint32_t begin(uint64_t s) { return uint32_t(s); }
+  static uint32_t end(uint64_t s) { return uint32_t(s >> 32); }
+
+  // the owner's next task, or false if it's out
+  bool pop(uint32_t& task) {
+    uint64_t s = span.load();
+    while (begin(s) < end(s)) {
+      if (span.compare_exchange_weak(s, pack(begin(s) + 1, end(s)))) {
+        task = begin(s);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // cuts off the back half, or false if there's nothing to take
+  bool steal(uint32_t& from, uint32_t& to) {
+    uint64_t s = span.load();
+    while (begin(s) < end(s)) {
+      uint32_t mid = begin(s) + (end(s) - begin(s)) / 2;
+      if (span.compare_exchange_weak(s, pack(begin(s), mid))) {
+        from = mid;
+        to = end(s);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t left() const {
+    uint64_t s = span.load();
+    return begin(s) < end(s) ? end(s) - begin(s) : 0;
+  }
+};
+}  // namespace detail
+
+// Runs fn(task) for every task in [0, count) on `threads`
+// threads, with work stealing; fn must be safe to run
+// concurrently with itself
+template <typename Fn>
+void run_stealing(size_t count, size_t threads, Fn&& fn) {
+  threads = std::max<size_t>(1, std::min(threads, count));
+  std::vector<detail::TaskRange> ranges(threads);
+  for (size_t t = 0; t < threads; ++t)
+    ranges[t].span = detail::TaskRange::pack(
+        uint32_t(count * t / threads), uint32_t(count * (t + 1) / threads));
+
+  auto work = [&](size_t self) {
+    auto& mine = ranges[self];
+    for (;;) {
+      uint32_t task;
+      while (mine.pop(task))
+        fn(size_t(task));
+      // steal from whoever has the most left
+      size_t victim = self, most = 0;
+      for (size_t t = 0; t < threads; ++t) {
+        size_t left = ranges[t].left();
+        if (t != self && left > most) {
+          victim = t;
+          most = left;
+        }
+      }
+      uint32_t from, to;
+      if (most == 0)
+        return;
+      if (ranges[victim].steal(from, to))
+        mine.span = detail::TaskRange::pack(from, to);
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; ++t)
+    pool.emplace_back(work, t);
+  work(0);
+  for (auto& thread : pool)
+    thread.join();
+}
+
+struct ChunkOptions {
+  size_t chunk_size{4 << 20};
+  size_t threads{0};  // zero is one per hardware thread
+};
+
+// Runs fn(chunk) over the newline-aligned chunks of `text`
+// in parallel, and returns the results in chunk order
+template <typename Fn>
+auto parse_chunks(std::string_view text, Fn&& fn,
+                  const ChunkOptions& opts = {}) {
+  using Result = decltype(fn(text));
+  static_assert(!std::is_same<Result, bool>::value,
+                "vector<bool> can't be written from many threads");
+  auto chunks = split_chunks(text, opts.chunk_size);
+  std::vector<Result> results(chunks.size());
+  size_t threads = opts.threads;
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  run_stealing(chunks.size(), threads,
+               [&](size_t i) { results[i] = fn(chunks[i]); });
+  return results;
+}
+
+}  // namespace darr
@@ -0,0 +1,108 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chunked.h"
+#include "parser.h"
+
+/*
+ * Times parse_person over a large newline-delimited file,
+ * on 1, 2, 4, ... threads up to the core count.
+ *
+ *     chunked_bench [MB | FILE]
+ *
+ * With a number (256 by default) it writes a file of that
+ * many megabytes of synthetic "/first/last/age" lines first,
+ * about one in twenty of them bad.
+ */
+
+namespace darr {
+namespace {
+using Clock = std::chrono::steady_clock;
+
+std::string generate(size_t megabytes) {
+  std::string path = "/tmp/chunked_bench." + std::to_string(getpid());
+  std::ofstream out{path};
+  std::mt19937_64 rng{1};
+  std::string line;
+  for (size_t written = 0; written < megabytes << 20; written += line.size()) {
+    line = "/first" + std::to_string(rng() % 100000) + "/last" +
+           std::to_string(rng() % 1000);
+    if (rng() % 20 == 0)
+      line += "/old";
+    else if (rng() % 4)
+      line += "/" + std::to_string(rng() % 100);
+    line += "\n";
+    out << line;
+  }
+  return path;
+}
+
+struct Counts {
+  size_t rows{0};
+  size_t parsed{0};
+  uint64_t ages{0};
+};
+
+// a chunk into columns, with buffers reused per thread
+Counts parse_chunk(std::string_view chunk) {
+  thread_local std::vector<std::string_view> lines;
+  thread_local ColumnBatch batch;
+  lines.clear();
+  for_each_line(chunk, [](std::string_view line) { lines.push_back(line); });
+  Counts c;
+  c.rows = lines.size();
+  c.parsed = parse_person_batch(chunk, lines.data(), lines.size(), batch);
+  const uint32_t* ages = batch.values<uint32_t>(2);
+  for (size_t row = 0; row < c.rows; ++row)
+    if (batch.ok(row) && batch.valid(2, row))
+      c.ages += ages[row];
+  return c;
+}
+
+int run(const std::string& arg) {
+  bool is_size = arg.find_first_not_of("0123456789") == std::string::npos;
+  std::string path = is_size ? generate(std::stoul(arg)) : arg;
+  MappedFile file{path};
+  auto text = file.text();
+
+  size_t cores = std::max(1u, std::thread::hardware_concurrency());
+  std::printf("%.1f MB, %zu cores\n", text.size() / 1e6, cores);
+  double base = 0;
+  for (size_t threads = 1;; threads = std::min(threads * 2, cores)) {
+    ChunkOptions opts;
+    opts.threads = threads;
+    auto start = Clock::now();
+    auto results = parse_chunks(text, parse_chunk, opts);
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Counts total;
+    for (auto& c : results) {
+      total.rows += c.rows;
+      total.parsed += c.parsed;
+      total.ages += c.ages;
+    }
+    double gbps = text.size() / secs / 1e9;
+    base = base ? base : gbps;
+    std::printf("%3zu threads: %6.2f GB/s (%.2fx)  %zu of %zu parsed (%llu)\n",
+                threads, gbps, gbps / base, total.parsed, total.rows,
+                (unsigned long long)total.ages);
+    if (threads == cores)
+      break;
+  }
+  if (is_size)
+    unlink(path.c_str());
+  return 0;
+}
+}  // namespace
+}  // namespace darr
+
+int main(int argc, char** argv) {
+  return darr::run(argc > 1 ? argv[1] : "256");
+}
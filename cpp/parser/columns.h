@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+/*
+ * The output of a batch parse, with a column per grammar
+ * field in the order the grammar names them.  String columns
+ * hold offset/length spans into the source text, which must
+ * outlive the batch; integer columns hold packed values of
+ * the setter's type.  Each column has a validity bitmap of
+ * the rows that set it, and the batch has one of the rows
+ * that parsed.
+ *
+ *     ColumnBatch batch;
+ *     parse_person_batch(source, inputs, n, batch);
+ *     batch.string(0, row);          // first_name
+ *     batch.values<uint32_t>(2);     // every age
+ *
+ * Nothing is allocated per row: reset() sizes every column
+ * for the whole batch, and keeps the memory between batches.
+ */
+
+namespace darr {
+
+class ColumnBatch {
+ public:
+  struct Span {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  // starts a batch of `rows` rows over `source`
+  void reset(std::string_view source, size_t rows) {
+    if (source.size() > UINT32_MAX)
+      throw std::length_error("source too large for a column batch");
+    base_ = source.data();
+    rows_ = rows;
+    for (auto& column : columns_)
+      column.resize(rows_);
+    ok_.assign((rows_ + 63) / 64, 0);
+  }
+
+  size_t rows() const { return rows_; }
+  size_t columns() const { return columns_.size(); }
+
+  bool ok(size_t row) const { return test(ok_, row); }
+  bool valid(size_t column, size_t row) const {
+    return test(columns_.at(column).validity, row);
+  }
+  const uint64_t* validity(size_t column) const {
+    return columns_.at(column).validity.data();
+  }
+
+  const Span* spans(size_t column) const {
+    return reinterpret_cast<const Span*>(typed(column, sizeof(Span)));
+  }
+  std::string_view string(size_t column, size_t row) const {
+    const Span& s = spans(column)[row];
+    return {base_ + s.offset, s.length};
+  }
+  template <typename V>
+  const V* values(size_t column) const {
+    return reinterpret_cast<const V*>(typed(column, sizeof(V)));
+  }
+
+  // --- used by the grammar ---
+  // makes a column of `width` bytes per row, the first time
+  void declare(size_t column, size_t width) {
+    if (column >= columns_.size())
+      columns_.resize(column + 1);
+    auto& c = columns_[column];
+    if (c.width == 0) {
+      c.width = width;
+      c.resize(rows_);
+    } else if (c.width != width) {
+      throw std::invalid_argument("column has another type");
+    }
+  }
+  void set_ok(size_t row, bool ok) {
+    if (ok)
+      ok_[row / 64] |= uint64_t(1) << (row % 64);
+  }
+  void set_string(size_t column, size_t row, std::string_view s) {
+    Span span{uint32_t(s.data() - base_), uint32_t(s.size())};
+    set(column, row, &span, sizeof(span));
+  }
+  template <typename V>
+  void set_value(size_t column, size_t row, V v) {
+    set(column, row, &v, sizeof(v));
+  }
+
+ private:
+  struct Column {
+    size_t width{0};               // bytes per row
+    std::vector<uint64_t> data;    // rows * width bytes, 8-aligned
+    std::vector<uint64_t> validity;
+
+    void resize(size_t rows) {
+      data.resize((rows * width + 7) / 8);
+      validity.assign((rows + 63) / 64, 0);
+    }
+  };
+
+  static bool test(const std::vector<uint64_t>& bits, size_t row) {
+    return (bits[row / 64] >> (row % 64)) & 1;
+  }
+
+  const uint64_t* typed(size_t column, size_t width) const {
+    auto& c = columns_.at(column);
+    if (c.width != width)
+      throw std::invalid_argument("column has another type");
+    return c.data.data();
+  }
+
+  void set(size_t column, size_t row, const void* v, size_t width) {
+    auto& c = columns_[column];
+    std::memcpy(reinterpret_cast<uint8_t*>(c.data.data()) + row * width, v,
+                width);
+    c.validity[row / 64] |= uint64_t(1) << (row % 64);
+  }
+
+ private:
+  const char* base_{nullptr};
+  size_t rows_{0};
+  std::vector<Column> columns_;
+  std::vector<uint64_t> ok_;
+};
+
+}  // namespace darr
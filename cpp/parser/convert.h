@@ -0,0 +1,492 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+/*
+ * Text to numbers, for the grammar's fields.  Each works like
+ * std::from_chars: it reads a number from the front of
+ * [first, last) and returns where it stopped, with
+ *
+ *     std::errc()                     it read one (anything
+ *                                     from ptr on is left over)
+ *     std::errc::invalid_argument     there was no number
+ *     std::errc::result_out_of_range  it didn't fit in the type
+ *
+ * so trailing garbage is `ptr != last`.  The value is only
+ * written when there's no error.
+ *
+ *     uint32_t age;
+ *     auto r = convert::parse(s.data(), s.data() + s.size(), age);
+ *
+ * Integers are decimal with an optional '-' for signed types,
+ * or hex with an optional "0x" through parse_hex, and take
+ * eight digits at a time where there are eight to take:
+ * they're checked and summed as one 64-bit word (SWAR) rather
+ * than a digit at a time.  bool is "true", "false", "1" or
+ * "0".  Floats are decimal with an optional fraction and
+ * exponent, correctly rounded: exact when the digits and
+ * power of ten both fit the type (Clinger), else Eisel and
+ * Lemire's 128-bit product against a table of powers of five
+ * for 10^-64 to 10^64, which covers what we see in logs.
+ * Anything beyond, or past 19 significant digits, goes to
+ * strtod.
+ */
+
+namespace darr {
+namespace convert {
+namespace detail {
+
+inline bool is_digit(char c) { return unsigned(c - '0') < 10; }
+
+// The eight digits at p as a number, or false if they aren't
+// all digits.  Each byte is a digit if its top nibble is 3
+// and adding 6 doesn't carry out of the bottom one.
+inline bool eight_digits(const char* p, uint64_t& v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t x;
+  std::memcpy(&x, p, 8);
+  if (((x & 0xF0F0F0F0F0F0F0F0) |
+       (((x + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) !=
+      0x3333333333333333)
+    return false;
+  // pairs, then fours, then all eight
+  x -= 0x3030303030303030;
+  x = x * 10 + (x >> 8);
+  v = (((x & 0x000000FF000000FF) * (100 + (1000000ULL << 32))) +
+       (((x >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32)))) >>
+      32;
+  return true;
+#else
+  v = 0;
+  for (int i = 0; i < 8; ++i) {
+    if (!is_digit(p[i]))
+      return false;
+    v = v * 10 + (p[i] - '0');
+  }
+  return true;
+#endif
+}
+
+// Adds the digits from p onto `acc`, and returns where they
+// end; sets `overflow` if they don't fit in 64 bits
+inline const char* digits(const char* p, const char* last, uint64_t& acc,
+                          bool& overflow) {
+  uint64_t eight;
+  while (last - p >= 8 && eight_digits(p, eight)) {
+    overflow |= __builtin_mul_overflow(acc, uint64_t(100000000), &acc) ||
+                __builtin_add_overflow(acc, eight, &acc);
+    p += 8;
+  }
+  for (; p < last && is_digit(*p); ++p)
+    overflow |= __builtin_mul_overflow(acc, uint64_t(10), &acc) ||
+                __builtin_add_overflow(acc, uint64_t(*p - '0'), &acc);
+  return p;
+}
+
+inline int hex_digit(char c) {
+  if (is_digit(c))
+    return c - '0';
+  c |= 0x20;  // lower case
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+template <typename T>
+using if_integer =
+    typename std::enable_if<std::is_integral<T>::value &&
+                                !std::is_same<T, bool>::value,
+                            int>::type;
+
+// the magnitude read up to p, as a T
+template <typename T>
+std::from_chars_result narrow(const char* p, uint64_t mag, bool negative,
+                              bool overflow, T& out) {
+  using U = typename std::make_unsigned<T>::type;
+  uint64_t limit = uint64_t(std::numeric_limits<T>::max()) + negative;
+  if (overflow || mag > limit)
+    return {p, std::errc::result_out_of_range};
+  out = negative ? T(U(0) - U(mag)) : T(mag);
+  return {p, std::errc()};
+}
+
+// --- floats ---
+
+template <typename F>
+struct Binary;
+template <>
+struct Binary<double> {
+  using Bits = uint64_t;
+  static constexpr int mantissa_bits = 52;
+  static constexpr int min_exponent = -1023;
+  static constexpr int infinite_power = 0x7FF;
+  static constexpr int round_even_min = -4;
+  static constexpr int round_even_max = 23;
+  static constexpr int exact_power = 22;
+  static constexpr uint64_t exact_mantissa = uint64_t(1) << 53;
+  static double strto(const char* s, char** end) { return std::strtod(s, end); }
+};
+template <>
+struct Binary<float> {
+  using Bits = uint32_t;
+  static constexpr int mantissa_bits = 23;
+  static constexpr int min_exponent = -127;
+  static constexpr int infinite_power = 0xFF;
+  static constexpr int round_even_min = -17;
+  static constexpr int round_even_max = 10;
+  static constexpr int exact_power = 10;
+  static constexpr uint64_t exact_mantissa = uint64_t(1) << 24;
+  static float strto(const char* s, char** end) { return std::strtof(s, end); }
+};
+
+// 5^q for q in [POW5_MIN, POW5_MAX], normalized to 128 bits
+// with the top bit set: truncated for q >= 0, and rounded up
+// for q < 0.  These are the matching rows of fast_float's
+// power_of_five_128 table.
+constexpr int POW5_MIN = -64;
+constexpr int POW5_MAX = 64;
+constexpr uint64_t POW5[] = {
+    0xa87fea27a539e9a5, 0x3f2398d747b36224,
+    0xd29fe4b18e88640e, 0x8eec7f0d19a03aad,
+    0x83a3eeeef9153e89, 0x1953cf68300424ac,
+    0xa48ceaaab75a8e2b, 0x5fa8c3423c052dd7,
+    0xcdb02555653131b6, 0x3792f412cb06794d,
+    0x808e17555f3ebf11, 0xe2bbd88bbee40bd0,
+    0xa0b19d2ab70e6ed6, 0x5b6aceaeae9d0ec4,
+    0xc8de047564d20a8b, 0xf245825a5a445275,
+    0xfb158592be068d2e, 0xeed6e2f0f0d56712,
+    0x9ced737bb6c4183d, 0x55464dd69685606b,
+    0xc428d05aa4751e4c, 0xaa97e14c3c26b886,
+    0xf53304714d9265df, 0xd53dd99f4b3066a8,
+    0x993fe2c6d07b7fab, 0xe546a8038efe4029,
+    0xbf8fdb78849a5f96, 0xde98520472bdd033,
+    0xef73d256a5c0f77c, 0x963e66858f6d4440,
+    0x95a8637627989aad, 0xdde7001379a44aa8,
+    0xbb127c53b17ec159, 0x5560c018580d5d52,
+    0xe9d71b689dde71af, 0xaab8f01e6e10b4a6,
+    0x9226712162ab070d, 0xcab3961304ca70e8,
+    0xb6b00d69bb55c8d1, 0x3d607b97c5fd0d22,
+    0xe45c10c42a2b3b05, 0x8cb89a7db77c506a,
+    0x8eb98a7a9a5b04e3, 0x77f3608e92adb242,
+    0xb267ed1940f1c61c, 0x55f038b237591ed3,
+    0xdf01e85f912e37a3, 0x6b6c46dec52f6688,
+    0x8b61313bbabce2c6, 0x2323ac4b3b3da015,
+    0xae397d8aa96c1b77, 0xabec975e0a0d081a,
+    0xd9c7dced53c72255, 0x96e7bd358c904a21,
+    0x881cea14545c7575, 0x7e50d64177da2e54,
+    0xaa242499697392d2, 0xdde50bd1d5d0b9e9,
+    0xd4ad2dbfc3d07787, 0x955e4ec64b44e864,
+    0x84ec3c97da624ab4, 0xbd5af13bef0b113e,
+    0xa6274bbdd0fadd61, 0xecb1ad8aeacdd58e,
+    0xcfb11ead453994ba, 0x67de18eda5814af2,
+    0x81ceb32c4b43fcf4, 0x80eacf948770ced7,
+    0xa2425ff75e14fc31, 0xa1258379a94d028d,
+    0xcad2f7f5359a3b3e, 0x096ee45813a04330,
+    0xfd87b5f28300ca0d, 0x8bca9d6e188853fc,
+    0x9e74d1b791e07e48, 0x775ea264cf55347e,
+    0xc612062576589dda, 0x95364afe032a819e,
+    0xf79687aed3eec551, 0x3a83ddbd83f52205,
+    0x9abe14cd44753b52, 0xc4926a9672793543,
+    0xc16d9a0095928a27, 0x75b7053c0f178294,
+    0xf1c90080baf72cb1, 0x5324c68b12dd6339,
+    0x971da05074da7bee, 0xd3f6fc16ebca5e04,
+    0xbce5086492111aea, 0x88f4bb1ca6bcf585,
+    0xec1e4a7db69561a5, 0x2b31e9e3d06c32e6,
+    0x9392ee8e921d5d07, 0x3aff322e62439fd0,
+    0xb877aa3236a4b449, 0x09befeb9fad487c3,
+    0xe69594bec44de15b, 0x4c2ebe687989a9b4,
+    0x901d7cf73ab0acd9, 0x0f9d37014bf60a11,
+    0xb424dc35095cd80f, 0x538484c19ef38c95,
+    0xe12e13424bb40e13, 0x2865a5f206b06fba,
+    0x8cbccc096f5088cb, 0xf93f87b7442e45d4,
+    0xafebff0bcb24aafe, 0xf78f69a51539d749,
+    0xdbe6fecebdedd5be, 0xb573440e5a884d1c,
+    0x89705f4136b4a597, 0x31680a88f8953031,
+    0xabcc77118461cefc, 0xfdc20d2b36ba7c3e,
+    0xd6bf94d5e57a42bc, 0x3d32907604691b4d,
+    0x8637bd05af6c69b5, 0xa63f9a49c2c1b110,
+    0xa7c5ac471b478423, 0x0fcf80dc33721d54,
+    0xd1b71758e219652b, 0xd3c36113404ea4a9,
+    0x83126e978d4fdf3b, 0x645a1cac083126ea,
+    0xa3d70a3d70a3d70a, 0x3d70a3d70a3d70a4,
+    0xcccccccccccccccc, 0xcccccccccccccccd,
+    0x8000000000000000, 0x0000000000000000,
+    0xa000000000000000, 0x0000000000000000,
+    0xc800000000000000, 0x0000000000000000,
+    0xfa00000000000000, 0x0000000000000000,
+    0x9c40000000000000, 0x0000000000000000,
+    0xc350000000000000, 0x0000000000000000,
+    0xf424000000000000, 0x0000000000000000,
+    0x9896800000000000, 0x0000000000000000,
+    0xbebc200000000000, 0x0000000000000000,
+    0xee6b280000000000, 0x0000000000000000,
+    0x9502f90000000000, 0x0000000000000000,
+    0xba43b74000000000, 0x0000000000000000,
+    0xe8d4a51000000000, 0x0000000000000000,
+    0x9184e72a00000000, 0x0000000000000000,
+    0xb5e620f480000000, 0x0000000000000000,
+    0xe35fa931a0000000, 0x0000000000000000,
+    0x8e1bc9bf04000000, 0x0000000000000000,
+    0xb1a2bc2ec5000000, 0x0000000000000000,
+    0xde0b6b3a76400000, 0x0000000000000000,
+    0x8ac7230489e80000, 0x0000000000000000,
+    0xad78ebc5ac620000, 0x0000000000000000,
+    0xd8d726b7177a8000, 0x0000000000000000,
+    0x878678326eac9000, 0x0000000000000000,
+    0xa968163f0a57b400, 0x0000000000000000,
+    0xd3c21bcecceda100, 0x0000000000000000,
+    0x84595161401484a0, 0x0000000000000000,
+    0xa56fa5b99019a5c8, 0x0000000000000000,
+    0xcecb8f27f4200f3a, 0x0000000000000000,
+    0x813f3978f8940984, 0x4000000000000000,
+    0xa18f07d736b90be5, 0x5000000000000000,
+    0xc9f2c9cd04674ede, 0xa400000000000000,
+    0xfc6f7c4045812296, 0x4d00000000000000,
+    0x9dc5ada82b70b59d, 0xf020000000000000,
+    0xc5371912364ce305, 0x6c28000000000000,
+    0xf684df56c3e01bc6, 0xc732000000000000,
+    0x9a130b963a6c115c, 0x3c7f400000000000,
+    0xc097ce7bc90715b3, 0x4b9f100000000000,
+    0xf0bdc21abb48db20, 0x1e86d40000000000,
+    0x96769950b50d88f4, 0x1314448000000000,
+    0xbc143fa4e250eb31, 0x17d955a000000000,
+    0xeb194f8e1ae525fd, 0x5dcfab0800000000,
+    0x92efd1b8d0cf37be, 0x5aa1cae500000000,
+    0xb7abc627050305ad, 0xf14a3d9e40000000,
+    0xe596b7b0c643c719, 0x6d9ccd05d0000000,
+    0x8f7e32ce7bea5c6f, 0xe4820023a2000000,
+    0xb35dbf821ae4f38b, 0xdda2802c8a800000,
+    0xe0352f62a19e306e, 0xd50b2037ad200000,
+    0x8c213d9da502de45, 0x4526f422cc340000,
+    0xaf298d050e4395d6, 0x9670b12b7f410000,
+    0xdaf3f04651d47b4c, 0x3c0cdd765f114000,
+    0x88d8762bf324cd0f, 0xa5880a69fb6ac800,
+    0xab0e93b6efee0053, 0x8eea0d047a457a00,
+    0xd5d238a4abe98068, 0x72a4904598d6d880,
+    0x85a36366eb71f041, 0x47a6da2b7f864750,
+    0xa70c3c40a64e6c51, 0x999090b65f67d924,
+    0xd0cf4b50cfe20765, 0xfff4b4e3f741cf6d,
+    0x82818f1281ed449f, 0xbff8f10e7a8921a4,
+    0xa321f2d7226895c7, 0xaff72d52192b6a0d,
+    0xcbea6f8ceb02bb39, 0x9bf4f8a69f764490,
+    0xfee50b7025c36a08, 0x02f236d04753d5b4,
+    0x9f4f2726179a2245, 0x01d762422c946590,
+    0xc722f0ef9d80aad6, 0x424d3ad2b7b97ef5,
+    0xf8ebad2b84e0d58b, 0xd2e0898765a7deb2,
+    0x9b934c3b330c8577, 0x63cc55f49f88eb2f,
+    0xc2781f49ffcfa6d5, 0x3cbf6b71c76b25fb,
+};
+
+inline double exact_power_of_ten(int q) {
+  static constexpr double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                      1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                      1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                      1e18, 1e19, 1e20, 1e21, 1e22};
+  return powers[q];
+}
+
+// w * 10^q as the bits of an F, via Eisel-Lemire; false if q
+// is outside the table or the result isn't a normal F
+template <typename F>
+bool eisel_lemire(uint64_t w, int q, typename Binary<F>::Bits& bits) {
+  using B = Binary<F>;
+  if (q < POW5_MIN || q > POW5_MAX)
+    return false;
+  int lz = __builtin_clzll(w);
+  w <<= lz;
+
+  // the top bits of w * 5^q; a second word of 5^q only
+  // matters if the bits below those we keep are all ones
+  const uint64_t* pow5 = &POW5[2 * (q - POW5_MIN)];
+  unsigned __int128 product = (unsigned __int128)w * pow5[0];
+  uint64_t high = uint64_t(product >> 64), low = uint64_t(product);
+  constexpr uint64_t precision_mask = ~uint64_t(0) >> (B::mantissa_bits + 3);
+  if ((high & precision_mask) == precision_mask) {
+    uint64_t second = uint64_t(((unsigned __int128)w * pow5[1]) >> 64);
+    low += second;
+    high += second > low;
+  }
+
+  int upper = int(high >> 63);
+  int shift = upper + 64 - B::mantissa_bits - 3;
+  uint64_t mantissa = high >> shift;
+  // floor(log2(10^q)) + 63, in fixed point
+  int power2 = (((152170 + 65536) * q) >> 16) + 63 + upper - lz -
+               B::min_exponent;
+  if (power2 <= 0)
+    return false;  // subnormal
+
+  // exactly halfway, so round to even
+  if (low <= 1 && q >= B::round_even_min && q <= B::round_even_max &&
+      (mantissa & 3) == 1 && (mantissa << shift) == high)
+    mantissa &= ~uint64_t(1);
+  mantissa += mantissa & 1;
+  mantissa >>= 1;
+  if (mantissa >= (uint64_t(2) << B::mantissa_bits)) {
+    mantissa = uint64_t(1) << B::mantissa_bits;
+    ++power2;
+  }
+  mantissa &= ~(uint64_t(1) << B::mantissa_bits);
+  if (power2 >= B::infinite_power)
+    return false;
+  bits = typename B::Bits(mantissa | (uint64_t(power2) << B::mantissa_bits));
+  return true;
+}
+
+// [first, last) by strtod, for what the fast paths can't do
+template <typename F>
+std::from_chars_result strto(const char* first, const char* last, F& out) {
+  char buf[128];
+  std::string big;
+  const char* s = buf;
+  size_t n = last - first;
+  if (n < sizeof(buf)) {
+    std::memcpy(buf, first, n);
+    buf[n] = 0;
+  } else {
+    big.assign(first, last);
+    s = big.c_str();
+  }
+  char* end;
+  F v = Binary<F>::strto(s, &end);
+  if (std::isinf(v) || v == 0)
+    return {last, std::errc::result_out_of_range};
+  out = v;
+  return {last, std::errc()};
+}
+}  // namespace detail
+
+// signed or unsigned decimal integers
+template <typename T, detail::if_integer<T> = 0>
+std::from_chars_result parse(const char* first, const char* last, T& out) {
+  const char* p = first;
+  bool negative = std::is_signed<T>::value && p < last && *p == '-';
+  p += negative;
+  uint64_t mag = 0;
+  bool overflow = false;
+  const char* end = detail::digits(p, last, mag, overflow);
+  if (end == p)
+    return {first, std::errc::invalid_argument};
+  return detail::narrow(end, mag, negative, overflow, out);
+}
+
+// hex integers, with or without "0x"
+template <typename T, detail::if_integer<T> = 0>
+std::from_chars_result parse_hex(const char* first, const char* last, T& out) {
+  const char* p = first;
+  if (last - p > 2 && p[0] == '0' && (p[1] | 0x20) == 'x' &&
+      detail::hex_digit(p[2]) >= 0)
+    p += 2;
+  const char* start = p;
+  uint64_t mag = 0;
+  bool overflow = false;
+  for (int d; p < last && (d = detail::hex_digit(*p)) >= 0; ++p) {
+    overflow |= mag >> 60 != 0;
+    mag = mag << 4 | d;
+  }
+  if (p == start)
+    return {first, std::errc::invalid_argument};
+  return detail::narrow(p, mag, false, overflow, out);
+}
+
+inline std::from_chars_result parse(const char* first, const char* last,
+                                    bool& out) {
+  size_t n = last - first;
+  if (n >= 4 && std::memcmp(first, "true", 4) == 0) {
+    out = true;
+    return {first + 4, std::errc()};
+  }
+  if (n >= 5 && std::memcmp(first, "false", 5) == 0) {
+    out = false;
+    return {first + 5, std::errc()};
+  }
+  if (n >= 1 && (*first == '0' || *first == '1')) {
+    out = *first == '1';
+    return {first + 1, std::errc()};
+  }
+  return {first, std::errc::invalid_argument};
+}
+
+// [-]digits[.digits][(e|E)[+|-]digits], as a float or double
+template <typename F, typename std::enable_if<
+                          std::is_floating_point<F>::value, int>::type = 0>
+std::from_chars_result parse(const char* first, const char* last, F& out) {
+  using B = detail::Binary<F>;
+  const char* p = first;
+  bool negative = p < last && *p == '-';
+  p += negative;
+
+  // every digit into w, wrapping if there are more than 19;
+  // we count them, so we know when it has
+  uint64_t w = 0;
+  bool wrapped = false;
+  const char* int_begin = p;
+  p = detail::digits(p, last, w, wrapped);
+  size_t count = p - int_begin;
+  int64_t q = 0;
+  if (p < last && *p == '.') {
+    const char* frac_begin = ++p;
+    p = detail::digits(p, last, w, wrapped);
+    q = -(p - frac_begin);
+    count += p - frac_begin;
+  }
+  if (count == 0)
+    return {first, std::errc::invalid_argument};
+  const char* mantissa_end = p;
+
+  // an exponent only counts if it has digits
+  if (p < last && (*p | 0x20) == 'e') {
+    const char* e = p + 1;
+    bool e_negative = e < last && *e == '-';
+    e += e < last && (*e == '-' || *e == '+');
+    if (e < last && detail::is_digit(*e)) {
+      int64_t exp = 0;
+      for (; e < last && detail::is_digit(*e); ++e)
+        exp = exp < 100000 ? exp * 10 + (*e - '0') : exp;
+      q += e_negative ? -exp : exp;
+      p = e;
+    }
+  }
+
+  if (count > 19) {
+    // leading zeros don't count
+    size_t zeros = 0;
+    for (const char* z = int_begin; z < mantissa_end; ++z) {
+      if (*z == '0')
+        ++zeros;
+      else if (*z != '.')
+        break;
+    }
+    if (count - zeros > 19)
+      return detail::strto(first, p, out);
+  }
+
+  if (w == 0) {
+    out = negative ? -F(0) : F(0);
+    return {p, std::errc()};
+  }
+  if (q >= -B::exact_power && q <= B::exact_power && w <= B::exact_mantissa) {
+    // w and 10^|q| are exact, so one rounding
+    F v = F(w);
+    F power = F(detail::exact_power_of_ten(int(q < 0 ? -q : q)));
+    v = q < 0 ? v / power : v * power;
+    out = negative ? -v : v;
+    return {p, std::errc()};
+  }
+  typename B::Bits bits;
+  if (!detail::eisel_lemire<F>(w, int(q), bits))
+    return detail::strto(first, p, out);
+  if (negative)
+    bits |= typename B::Bits(1) << (sizeof(bits) * 8 - 1);
+  std::memcpy(&out, &bits, sizeof(out));
+  return {p, std::errc()};
+}
+
+}  // namespace convert
+}  // namespace darr
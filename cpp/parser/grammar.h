@@ -0,0 +1,1006 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "arena.h"
+#include "columns.h"
+#include "convert.h"
+#include "structural.h"
+
+/*
+ * This class implements a static parser for delimited text
+ * which allows grammars to be expressively defined.  All
+ * calls are static and can be optimized and inlined by
+ * the compiler.
+ *
+ * The following defines a parser which parses slash-delimited
+ * list of strings (like a URL) into an object.
+ *
+ *     PathParse p = {path};
+ *     start_parse(p, person, "/")        //
+ *         / &Person::mutable_first_name  //
+ *         / &Person::mutable_last_name   //
+ *         / optional(&Person::set_age)   //
+ *         ;
+ *
+ * It works by implementing `operator/()` for a few method
+ * signatures, and then doing string-to-object conversion
+ * to call the object's setters.
+ *
+ * For example "/ &Person::mutable_last_name" will call
+ *
+ *    PathContext<Person> operator/(
+ *      PathContext<Person>& ctx,      // our object
+ *      std::string* (Person::*)()     // function pointer
+ *    )
+ *
+ * A field can also be a setter taking a std::string_view,
+ * like `&PersonView::set_first_name`, which is handed the
+ * segment itself, so nothing is copied or allocated; or, if
+ * the parse has a StringArena, a copy of it in the arena.
+ * Or it can be a data member: a number, or anything a
+ * string_view can be assigned to, like the StringPtr fields
+ * of an ipc message, which append it to the message's own
+ * string table (see request_url.cpp).  Numbers are decimal,
+ * but an integer setter wrapped as hex(&T::set_x) takes hex.
+ *
+ * Query strings are a set of keys rather than a sequence of
+ * segments, declared once, as a constant:
+ *
+ *     constexpr auto keys = key("first", &Person::mutable_first_name)
+ *                         & key("age", optional(&Person::set_age));
+ *     query(p, person, "?") & keys;
+ *
+ * See "QUERY STRINGS" below.  "FUSED GRAMMARS" are the same
+ * positional grammars declared as a type, which parse in one
+ * pass and stop at the first failure.  And "ROUTES" puts
+ * many grammars behind one scan of the path, by the literal
+ * segments they start with.
+ *
+ * The delimiters are '/' between segments and ',' within a
+ * pair unless start_parse is told otherwise, as a template
+ * argument: start_parse<'\t'>(p, record, "") for TSV, or
+ * start_parse<':'> for colon-separated records.
+ *
+ * Segments are split at each delimiter with std::find, unless
+ * the parse carries a StructuralIndex covering the path, in
+ * which case we jump straight to the next offset in it.
+ *
+ * And then it's just recursively defined from there.  It's
+ * probably best to start at the bottom of the file and
+ * work upwards.  The grammars themselves are in parser.cpp,
+ * and request_url.cpp for the ipc one.
+ */
+
+
+namespace darr {
+namespace dsl {
+
+//
+// --- CONVERTERS ----------------
+//
+// Functions which convert raw text to
+//
+template <typename T>
+std::optional<T> try_to(std::string_view segment) {
+  // the whole segment, or nothing; see convert.h
+  T v;
+  const char* end = segment.data() + segment.size();
+  auto r = darr::convert::parse(segment.data(), end, v);
+  if (r.ec != std::errc() || r.ptr != end)
+    return {};
+  return v;
+}
+
+template <>
+inline std::optional<std::string> try_to(std::string_view segment) {
+  return std::string{segment};
+}
+
+// the same, in hex, with or without "0x"
+template <typename T>
+std::optional<T> try_hex(std::string_view segment) {
+  T v;
+  const char* end = segment.data() + segment.size();
+  auto r = darr::convert::parse_hex(segment.data(), end, v);
+  if (r.ec != std::errc() || r.ptr != end)
+    return {};
+  return v;
+}
+
+//
+// --- UTIL ----------------
+//
+inline bool remove_prefix(std::string_view& tgt,
+                          const std::string_view prefix) {
+  if (tgt.size() >= prefix.size() &&
+      tgt.compare(0, prefix.size(), prefix) == 0) {
+    tgt.remove_prefix(prefix.size());
+    return true;
+  }
+  return false;
+}
+
+inline std::string_view split_step(std::string_view& tgt, char delimiter) {
+  auto make_sv = [](const char* b, const char* e) {
+    size_t sz = std::distance(b, e);
+    return std::string_view{b, sz};
+  };
+
+  auto it = std::find(tgt.begin(), tgt.end(), delimiter);
+  auto result = make_sv(tgt.begin(), it);
+
+  if (it != tgt.end())
+    it = std::next(it);
+  tgt = make_sv(it, tgt.end());
+
+  return result;
+}
+
+//
+// --- TYPES -----------------
+//
+
+// PathParse: holds the path as it's consumed
+struct PathParse {
+  std::string_view path;
+  bool ok{true};
+  const darr::StructuralIndex* index{nullptr};  // optional
+  darr::StringArena* arena{nullptr};            // optional
+};
+
+// split_step, but using the parse's index when it has one
+// which covers `tgt` and `delimiter`
+inline std::string_view next_segment(const PathParse& parse,
+                                     std::string_view& tgt, char delimiter) {
+  const char* begin = tgt.data();
+  const char* end = begin + tgt.size();
+  if (!parse.index || !parse.index->covers(begin, end, delimiter))
+    return split_step(tgt, delimiter);
+
+  const char* it = parse.index->find(begin, end, delimiter);
+  std::string_view result{begin, size_t(it - begin)};
+  if (it != end)
+    ++it;
+  tgt = std::string_view{it, size_t(end - it)};
+  return result;
+}
+
+// Delimiters: what a grammar splits on, between segments and
+// within a pair; they're a parameter of its type, so each is
+// a constant where it's used
+template <char SEGMENT = '/', char PAIR = ','>
+struct Delimiters {
+  static constexpr char segment = SEGMENT;
+  static constexpr char pair = PAIR;
+};
+
+// ParseContext: binds the parse to a target object
+template <typename TargetT, typename DelimitersT = Delimiters<>>
+struct ParseContext {
+  PathParse& parse;
+  TargetT& target;
+};
+
+// ColumnRow: a target which stands in for a T, writing T's
+// fields into a row of a ColumnBatch, a column per field
+template <typename T>
+struct ColumnRow {
+  darr::ColumnBatch& batch;
+  size_t row;
+  size_t field{0};  // the column the next field goes in
+};
+
+// NumericField / StringField: a pointer to a field; numbers
+// may be any integer type, bool, float or double
+template <typename T, typename V,
+          typename std::enable_if<std::is_arithmetic<V>::value, int>::type = 0>
+using NumericFn = void (T::*)(V);
+template <typename T, typename V,
+          typename std::enable_if<std::is_arithmetic<V>::value, int>::type = 0>
+struct NumericField {
+  constexpr NumericField(void (T::*fn)(V), bool req)
+      : setter{fn}, required{req} {}
+  NumericFn<T, V> setter;
+  bool required{true};
+};
+
+// HexField: an integer setter, given the segment as hex
+template <typename T, typename V>
+struct HexField {
+  static_assert(std::is_integral<V>::value, "hex is for integers");
+  constexpr HexField(void (T::*fn)(V), bool req) : setter{fn}, required{req} {}
+  NumericFn<T, V> setter;
+  bool required{true};
+};
+
+// NumericField / StringField: a pointer to a field
+template <typename T>
+using StringFn = std::string* (T::*)();
+template <typename T>
+struct StringField {
+  constexpr StringField(std::string* (T::*fn)(), bool req)
+      : getter{fn}, required{req} {}
+  StringFn<T> getter;
+  bool required{true};
+};
+
+// ViewField: a setter which takes the segment as a view
+template <typename T>
+using ViewFn = void (T::*)(std::string_view);
+template <typename T>
+struct ViewField {
+  constexpr ViewField(void (T::*fn)(std::string_view), bool req)
+      : setter{fn}, required{req} {}
+  ViewFn<T> setter;
+  bool required{true};
+};
+
+// MemberField: a data member, like a SerializedType's
+// StringPtr, which is assigned the segment and appends it to
+// the message's string table; or a number, converted
+template <typename M>
+using if_data = typename std::enable_if<!std::is_function<M>::value, int>::type;
+template <typename T, typename M>
+struct MemberField {
+  constexpr MemberField(M T::*m, bool req) : member{m}, required{req} {}
+  M T::*member;
+  bool required{true};
+};
+
+//
+// --- FACTORIES ----------------
+//
+
+template <typename DelimitersT = Delimiters<>, typename T>
+ParseContext<T, DelimitersT> parse_into(PathParse& parse, T& target) {
+  return {parse, target};
+}
+// start_parse<'\t'>(p, record, "") for tab-separated fields
+template <char SEGMENT = '/', char PAIR = ',', typename T, size_t N>
+ParseContext<T, Delimiters<SEGMENT, PAIR>> start_parse(
+    PathParse& parse, T& target, const char (&prefix)[N]) {
+  parse.ok = remove_prefix(parse.path, prefix);
+  return parse_into<Delimiters<SEGMENT, PAIR>>(parse, target);
+}
+template <typename T, typename V>
+constexpr auto required(NumericFn<T, V> setter) {
+  return NumericField<T, V>(setter, true);
+}
+template <typename DefT>
+constexpr auto required(DefT&& t) {
+  return std::forward<DefT>(t);  // required is default
+}
+template <typename T, typename V>
+constexpr auto optional(NumericFn<T, V> setter) {
+  return NumericField<T, V>(setter, false);
+}
+template <typename T>
+constexpr auto optional(StringFn<T> getter) {
+  return StringField<T>(getter, false);
+}
+template <typename T>
+constexpr auto optional(ViewFn<T> setter) {
+  return ViewField<T>(setter, false);
+}
+template <typename T, typename M, if_data<M> = 0>
+constexpr auto optional(M T::*member) {
+  return MemberField<T, M>(member, false);
+}
+// hex(&T::set_x), or optional(hex(&T::set_x))
+template <typename T, typename V>
+constexpr auto hex(NumericFn<T, V> setter) {
+  return HexField<T, V>(setter, true);
+}
+template <typename T, typename V>
+constexpr auto optional(HexField<T, V> fld) {
+  return HexField<T, V>(fld.setter, false);
+}
+
+//
+// --- PARSERS ----------------
+// These take a segment of the path and set the field
+// in the protobuf object
+// ---
+//
+
+#define CALL_MEMBER_FN(object, ptrToMember) ((object).*(ptrToMember))
+template <typename T, typename D, typename V>
+void parse_segment(ParseContext<T, D>& ctx, NumericField<T, V> fld,
+                   std::string_view segment) {
+  if (ctx.parse.ok && !segment.empty()) {
+    if (auto v = try_to<V>(segment)) {
+      CALL_MEMBER_FN(ctx.target, fld.setter)(*v);
+    } else {
+      ctx.parse.ok = false;
+    }
+  } else if (fld.required) {
+    ctx.parse.ok = false;
+  }
+}
+
+template <typename T, typename D, typename V>
+void parse_segment(ParseContext<T, D>& ctx, HexField<T, V> fld,
+                   std::string_view segment) {
+  if (ctx.parse.ok && !segment.empty()) {
+    if (auto v = try_hex<V>(segment)) {
+      CALL_MEMBER_FN(ctx.target, fld.setter)(*v);
+    } else {
+      ctx.parse.ok = false;
+    }
+  } else if (fld.required) {
+    ctx.parse.ok = false;
+  }
+}
+
+template <typename T, typename D>
+void parse_segment(ParseContext<T, D>& ctx, const StringField<T>& fld,
+                   std::string_view segment) {
+  if (ctx.parse.ok && !segment.empty()) {
+    auto* str = CALL_MEMBER_FN(ctx.target, fld.getter)();
+    str->assign(segment.begin(), segment.end());
+  } else if (fld.required) {
+    ctx.parse.ok = false;
+  }
+}
+
+// borrows the segment, or copies it to the parse's arena
+template <typename T, typename D>
+void parse_segment(ParseContext<T, D>& ctx, const ViewField<T>& fld,
+                   std::string_view segment) {
+  if (ctx.parse.ok && !segment.empty()) {
+    if (ctx.parse.arena)
+      segment = ctx.parse.arena->copy(segment);
+    CALL_MEMBER_FN(ctx.target, fld.setter)(segment);
+  } else if (fld.required) {
+    ctx.parse.ok = false;
+  }
+}
+
+template <typename T, typename D, typename M>
+void parse_segment(ParseContext<T, D>& ctx, const MemberField<T, M>& fld,
+                   std::string_view segment) {
+  if (ctx.parse.ok && !segment.empty()) {
+    if constexpr (std::is_arithmetic<M>::value) {
+      if (auto v = try_to<M>(segment)) {
+        ctx.target.*fld.member = *v;
+      } else {
+        ctx.parse.ok = false;
+      }
+    } else {
+      ctx.target.*fld.member = segment;
+    }
+  } else if (fld.required) {
+    ctx.parse.ok = false;
+  }
+}
+#undef CALL_MEMBER_FN
+
+template <typename T, typename D, typename V>
+void parse_segment(ParseContext<ColumnRow<T>, D>& ctx, NumericField<T, V> fld,
+                   std::string_view segment) {
+  auto& row = ctx.target;
+  size_t column = row.field++;
+  row.batch.declare(column, sizeof(V));
+  if (ctx.parse.ok && !segment.empty()) {
+    if (auto v = try_to<V>(segment)) {
+      row.batch.set_value(column, row.row, *v);
+    } else {
+      ctx.parse.ok = false;
+    }
+  } else if (fld.required) {
+    ctx.parse.ok = false;
+  }
+}
+
+template <typename T, typename D, typename V>
+void parse_segment(ParseContext<ColumnRow<T>, D>& ctx, HexField<T, V> fld,
+                   std::string_view segment) {
+  auto& row = ctx.target;
+  size_t column = row.field++;
+  row.batch.declare(column, sizeof(V));
+  if (ctx.parse.ok && !segment.empty()) {
+    if (auto v = try_hex<V>(segment)) {
+      row.batch.set_value(column, row.row, *v);
+    } else {
+      ctx.parse.ok = false;
+    }
+  } else if (fld.required) {
+    ctx.parse.ok = false;
+  }
+}
+
+template <typename T, typename D>
+void parse_segment(ParseContext<ColumnRow<T>, D>& ctx,
+                   const StringField<T>& fld, std::string_view segment) {
+  auto& row = ctx.target;
+  size_t column = row.field++;
+  row.batch.declare(column, sizeof(darr::ColumnBatch::Span));
+  if (ctx.parse.ok && !segment.empty()) {
+    row.batch.set_string(column, row.row, segment);
+  } else if (fld.required) {
+    ctx.parse.ok = false;
+  }
+}
+
+//
+// --- OPERATORS ------------------
+//
+
+template <typename T, typename D, typename FieldT1, typename FieldT2>
+ParseContext<T, D>& operator/(ParseContext<T, D>& ctx,
+                              std::pair<FieldT1, FieldT2> pair) {
+  // pull "a,b" from "a,b/c/d", then "a" from "a,b"
+  auto s = next_segment(ctx.parse, ctx.parse.path, D::segment);
+  parse_segment(ctx, pair.first, next_segment(ctx.parse, s, D::pair));
+  parse_segment(ctx, pair.second, s);
+  return ctx;
+}
+
+template <typename T, typename D, typename FieldT>
+ParseContext<T, D>& operator/(ParseContext<T, D>& ctx, FieldT&& fld) {
+  parse_segment(ctx, fld, next_segment(ctx.parse, ctx.parse.path, D::segment));
+  return ctx;
+}
+
+// the target may be a T or something standing in for one,
+// like a ColumnRow<T>
+template <typename TargetT, typename D, typename T, typename V>
+ParseContext<TargetT, D>& operator/(ParseContext<TargetT, D>& ctx,
+                                    NumericFn<T, V> setter) {
+  return ctx / NumericField<T, V>{setter, true};  // required by default
+}
+
+template <typename TargetT, typename D, typename T>
+ParseContext<TargetT, D>& operator/(ParseContext<TargetT, D>& ctx,
+                                    StringFn<T> getter) {
+  return ctx / StringField<T>{getter, true};  // required by default
+}
+
+template <typename T, typename D>
+ParseContext<T, D>& operator/(ParseContext<T, D>& ctx, ViewFn<T> setter) {
+  return ctx / ViewField<T>{setter, true};  // required by default
+}
+
+template <typename T, typename D, typename M, if_data<M> = 0>
+ParseContext<T, D>& operator/(ParseContext<T, D>& ctx, M T::*member) {
+  return ctx / MemberField<T, M>{member, true};  // required by default
+}
+
+template <typename T, typename D, typename SetterT>
+ParseContext<T, D>& operator/(ParseContext<T, D>&& ctx, SetterT&& setter) {
+  return ctx / std::forward<SetterT>(setter);
+}
+
+//
+// --- FUSED GRAMMARS ----------------
+// The same grammars as a type, declared once as a constant
+// rather than run as a chain of calls:
+//
+//     constexpr auto person = grammar("/")
+//         / &Person::mutable_first_name
+//         / &Person::mutable_last_name
+//         / optional(&Person::set_age);
+//     person.parse(p, target);
+//
+// parse() splits all the segments it has fields for in one
+// pass, then checks there are at least as many as the last
+// required field needs, a count worked out when the grammar
+// was built, before it converts anything.  Then it fills the
+// fields in order and stops at the first that fails; the
+// chain above splits every segment whatever happens.  When a
+// parse fails the target may be partly filled, as before.
+// ---
+//
+
+// what the grammar holds for each kind of field
+template <typename T, typename V>
+constexpr auto to_field(NumericFn<T, V> setter) {
+  return NumericField<T, V>{setter, true};  // required by default
+}
+template <typename T>
+constexpr auto to_field(StringFn<T> getter) {
+  return StringField<T>{getter, true};
+}
+template <typename T>
+constexpr auto to_field(ViewFn<T> setter) {
+  return ViewField<T>{setter, true};
+}
+template <typename T, typename M, if_data<M> = 0>
+constexpr auto to_field(M T::*member) {
+  return MemberField<T, M>{member, true};
+}
+template <typename FieldT>
+constexpr FieldT to_field(FieldT fld) {
+  return fld;
+}
+
+template <typename FieldT>
+constexpr bool is_required(const FieldT& fld) {
+  return fld.required;
+}
+template <typename FieldT1, typename FieldT2>
+constexpr bool is_required(const std::pair<FieldT1, FieldT2>& pair) {
+  return pair.first.required || pair.second.required;
+}
+
+template <typename T, typename D, typename FieldT>
+void fused_segment(ParseContext<T, D>& ctx, const FieldT& fld,
+                   std::string_view segment) {
+  parse_segment(ctx, fld, segment);
+}
+template <typename T, typename D, typename FieldT1, typename FieldT2>
+void fused_segment(ParseContext<T, D>& ctx,
+                   const std::pair<FieldT1, FieldT2>& pair,
+                   std::string_view segment) {
+  parse_segment(ctx, pair.first, next_segment(ctx.parse, segment, D::pair));
+  parse_segment(ctx, pair.second, segment);
+}
+
+template <typename D, typename... FieldTs>
+struct Grammar {
+  static constexpr size_t N = sizeof...(FieldTs);
+
+  std::string_view prefix;
+  std::tuple<FieldTs...> fields;
+  size_t needed{0};  // segments, up to the last required one
+
+  constexpr Grammar(std::string_view p, std::tuple<FieldTs...> f)
+      : prefix{p}, fields{f} {
+    init(std::index_sequence_for<FieldTs...>{});
+  }
+
+  template <typename T>
+  bool parse(PathParse& parse, T& target) const {
+    if (!parse.ok || !remove_prefix(parse.path, prefix))
+      return parse.ok = false;
+    std::array<std::string_view, N> segments;
+    size_t found = 0;
+    for (; found < N && !parse.path.empty(); ++found)
+      segments[found] = next_segment(parse, parse.path, D::segment);
+    if (found < needed)
+      return parse.ok = false;
+    ParseContext<T, D> ctx{parse, target};
+    return fill(ctx, segments, found, std::index_sequence_for<FieldTs...>{});
+  }
+
+ private:
+  template <size_t... I>
+  constexpr void init(std::index_sequence<I...>) {
+    ((needed = is_required(std::get<I>(fields)) ? I + 1 : needed), ...);
+  }
+
+  // the fields in order, until one fails
+  template <typename T, size_t... I>
+  bool fill(ParseContext<T, D>& ctx,
+            const std::array<std::string_view, N>& segments, size_t found,
+            std::index_sequence<I...>) const {
+    return ((fused_segment(ctx, std::get<I>(fields),
+                           I < found ? segments[I] : std::string_view{}),
+             ctx.parse.ok) &&
+            ...);
+  }
+};
+
+template <char SEGMENT = '/', char PAIR = ','>
+constexpr auto grammar(std::string_view prefix) {
+  return Grammar<Delimiters<SEGMENT, PAIR>>{prefix, {}};
+}
+
+template <typename D, typename... FieldTs, typename FieldT>
+constexpr auto operator/(const Grammar<D, FieldTs...>& g, FieldT fld) {
+  auto next = to_field(fld);
+  return Grammar<D, FieldTs..., decltype(next)>{
+      g.prefix, std::tuple_cat(g.fields, std::make_tuple(next))};
+}
+
+//
+// --- QUERY STRINGS ----------------
+// "?k1=v1&k2=v2" into the fields named by each key, in any
+// order.  The keys are hashed when the set of them is made,
+// at compile time when it's constexpr, into a table with a
+// slot per key (a perfect hash), so each pair costs a hash
+// and one compare against the only key it can be.
+//
+// Keys and values are taken as they are, not %-decoded.  A
+// missing required key fails the parse, and so does an empty
+// value for one.  Pairs with no key ("&&") are skipped.
+// ---
+//
+
+// what to do with a key we've already had, or don't know
+enum class Repeated { last, first, fail };
+enum class Unknown { skip, fail };
+
+// KeyField: a field named by a key
+template <typename FieldT>
+struct KeyField {
+  std::string_view name;
+  FieldT field;
+};
+
+constexpr uint32_t key_hash(std::string_view name) {
+  uint32_t h = 2166136261u;  // FNV-1a
+  for (char c : name)
+    h = (h ^ uint8_t(c)) * 16777619u;
+  return h;
+}
+
+// KeySet: the keys of a query string, and the perfect hash
+// that finds them; the slot for a hash is its top BITS bits
+// once multiplied by `seed`, which is the first odd number
+// that puts each key in a slot of its own
+template <typename... FieldTs>
+struct KeySet {
+  static constexpr size_t N = sizeof...(FieldTs);
+  static_assert(N <= 64, "at most 64 keys");
+  static constexpr int BITS = [] {
+    int bits = 3;  // a quarter full at most, so seeds are easy to find
+    while ((size_t(1) << bits) < 4 * N)
+      ++bits;
+    return bits;
+  }();
+
+  std::tuple<KeyField<FieldTs>...> keys;
+  std::array<std::string_view, N> names{};
+  std::array<uint8_t, size_t(1) << BITS> slots{};  // key + 1, or 0
+  uint32_t seed{1};
+  uint64_t required{0};  // a bit per required key
+
+  constexpr explicit KeySet(std::tuple<KeyField<FieldTs>...> k)
+      : keys{k} {
+    init(std::index_sequence_for<FieldTs...>{});
+  }
+
+  static constexpr size_t slot(uint32_t hash, uint32_t seed) {
+    return uint32_t(hash * seed) >> (32 - BITS);
+  }
+
+  // the index of `name`, or -1
+  int find(std::string_view name) const {
+    int i = slots[slot(key_hash(name), seed)] - 1;
+    return i >= 0 && names[i] == name ? i : -1;
+  }
+
+  // parses `value` into key i's field
+  template <typename T>
+  void parse(size_t i, ParseContext<T>& ctx, std::string_view value) const {
+    parse(i, ctx, value, std::index_sequence_for<FieldTs...>{});
+  }
+
+ private:
+  template <size_t... I>
+  constexpr void init(std::index_sequence<I...>) {
+    names = {std::get<I>(keys).name...};
+    required = ((uint64_t(std::get<I>(keys).field.required) << I) | ... | 0);
+    for (size_t i = 0; i < N; ++i)
+      for (size_t j = 0; j < i; ++j)
+        if (names[i] == names[j])
+          throw std::invalid_argument("repeated key");
+    for (;; seed += 2) {
+      if (seed > (1u << 20))
+        throw std::invalid_argument("no perfect hash for these keys");
+      slots = {};
+      size_t i = 0;
+      for (; i < N && !slots[slot(key_hash(names[i]), seed)]; ++i)
+        slots[slot(key_hash(names[i]), seed)] = uint8_t(i + 1);
+      if (i == N)
+        return;
+    }
+  }
+
+  template <typename T, size_t... I>
+  void parse(size_t i, ParseContext<T>& ctx, std::string_view value,
+             std::index_sequence<I...>) const {
+    ((i == I ? parse_segment(ctx, std::get<I>(keys).field, value) : void()),
+     ...);
+  }
+};
+
+template <typename FieldT>
+constexpr auto key(std::string_view name, FieldT field) {
+  return KeyField<FieldT>{name, field};
+}
+template <typename T, typename V>
+constexpr auto key(std::string_view name, NumericFn<T, V> setter) {
+  return key(name, NumericField<T, V>{setter, true});  // required by default
+}
+template <typename T>
+constexpr auto key(std::string_view name, StringFn<T> getter) {
+  return key(name, StringField<T>{getter, true});
+}
+template <typename T>
+constexpr auto key(std::string_view name, ViewFn<T> setter) {
+  return key(name, ViewField<T>{setter, true});
+}
+template <typename T, typename M, if_data<M> = 0>
+constexpr auto key(std::string_view name, M T::*member) {
+  return key(name, MemberField<T, M>{member, true});
+}
+
+template <typename FieldT1, typename FieldT2>
+constexpr auto operator&(KeyField<FieldT1> a, KeyField<FieldT2> b) {
+  return KeySet<FieldT1, FieldT2>{std::make_tuple(a, b)};
+}
+template <typename... FieldTs, typename FieldT>
+constexpr auto operator&(const KeySet<FieldTs...>& set, KeyField<FieldT> k) {
+  return KeySet<FieldTs..., FieldT>{
+      std::tuple_cat(set.keys, std::make_tuple(k))};
+}
+
+// QueryContext: binds a query-string parse to a target
+template <typename TargetT>
+struct QueryContext {
+  PathParse& parse;
+  TargetT& target;
+  Repeated repeated;
+  Unknown unknown;
+};
+
+template <typename T, size_t N>
+QueryContext<T> query(PathParse& parse, T& target, const char (&prefix)[N],
+                      Repeated repeated = Repeated::last,
+                      Unknown unknown = Unknown::skip) {
+  parse.ok = remove_prefix(parse.path, prefix);
+  return {parse, target, repeated, unknown};
+}
+
+template <typename T, typename... FieldTs>
+QueryContext<T>& operator&(QueryContext<T>& ctx,
+                           const KeySet<FieldTs...>& keys) {
+  auto& parse = ctx.parse;
+  ParseContext<T> fields{parse, ctx.target};
+  uint64_t seen = 0;
+  while (parse.ok && !parse.path.empty()) {
+    std::string_view value = next_segment(parse, parse.path, '&');
+    std::string_view name = next_segment(parse, value, '=');
+    if (name.empty())
+      continue;
+    int i = keys.find(name);
+    if (i < 0) {
+      parse.ok = ctx.unknown == Unknown::skip;
+      continue;
+    }
+    uint64_t bit = uint64_t(1) << i;
+    if (seen & bit) {
+      parse.ok = ctx.repeated != Repeated::fail;
+      if (ctx.repeated != Repeated::last)
+        continue;
+    }
+    seen |= bit;
+    keys.parse(i, fields, value);
+  }
+  if ((seen & keys.required) != keys.required)
+    parse.ok = false;
+  return ctx;
+}
+
+template <typename T, typename KeysT>
+QueryContext<T>& operator&(QueryContext<T>&& ctx, const KeysT& keys) {
+  return ctx & keys;
+}
+
+//
+// --- ROUTES ----------------
+// Picks one of many grammars by the literal segments a path
+// starts with, like "/v1/person" or "/health".  The literals
+// are made into a trie when the routes are put together, at
+// compile time when they're constexpr, with every edge
+// (parent node, segment) in a single perfect-hash table, as
+// for query keys.  A path is then scanned once, a segment at
+// a time, with a hash and a compare per segment however many
+// routes there are.
+//
+// The route whose literal is the longest match wins, and its
+// function parses what follows, from the '/' or '?' after
+// the literal:
+//
+//     constexpr auto routes =
+//         route("/v1/person", [](PathParse& p, Person& person) {
+//           return parse_person(p, person);  // "/first/last/age"
+//         })
+//         | route("/health", [](PathParse& p, Person&) {
+//           return p.path.empty();
+//         });
+//     int which = routes.dispatch(path, person);
+//
+// If that grammar fails, the next-longest literal that
+// matched gets a go, and so on, all from the one scan.  When
+// more than one literal matched, each grammar parses into a
+// copy of the targets, which replaces them only if it
+// succeeds, so a grammar that fails partway can't leave
+// fields behind for the next; the targets must be copyable.
+// With a single match the grammar parses in place, and on
+// failure may have filled some of the target, as any grammar
+// may.  The path's literal part ends at a '?'.
+// ---
+//
+
+// Route: a literal path, and the grammar for what's after it
+template <typename Fn>
+struct Route {
+  std::string_view literal;
+  Fn fn;
+};
+
+template <typename Fn>
+constexpr auto route(std::string_view literal, Fn fn) {
+  return Route<Fn>{literal, fn};
+}
+
+// the next segment of `path`, which starts with '/', and
+// leaves `path` after it; stops at a '?'
+constexpr bool next_literal(std::string_view& path, std::string_view& segment) {
+  if (path.empty() || path[0] != '/')
+    return false;
+  size_t end = 1;
+  while (end < path.size() && path[end] != '/' && path[end] != '?')
+    ++end;
+  segment = path.substr(1, end - 1);
+  path.remove_prefix(end);
+  return true;
+}
+
+template <typename... Fns>
+struct Router {
+  static constexpr size_t N = sizeof...(Fns);
+  static constexpr size_t MAX_SEGMENTS = 8;  // per literal
+  static constexpr size_t EDGES = N * MAX_SEGMENTS;
+  static constexpr int BITS = [] {
+    int bits = 3;
+    while ((size_t(1) << bits) < 4 * EDGES)
+      ++bits;
+    return bits;
+  }();
+
+  // node 0 is the root, and edge e leads to node e + 1
+  struct Edge {
+    uint16_t parent{0};
+    std::string_view segment;
+  };
+
+  std::tuple<Route<Fns>...> routes;
+  std::array<Edge, EDGES> edges{};
+  size_t edge_count{0};
+  std::array<int16_t, EDGES + 1> node_route{};  // or -1
+  std::array<uint16_t, size_t(1) << BITS> slots{};  // edge + 1, or 0
+  uint32_t seed{1};
+
+  constexpr explicit Router(std::tuple<Route<Fns>...> r) : routes{r} {
+    for (auto& route : node_route)
+      route = -1;
+    init(std::index_sequence_for<Fns...>{});
+  }
+
+  static constexpr size_t slot(uint16_t parent, std::string_view segment,
+                               uint32_t seed) {
+    uint32_t h = key_hash(segment) ^ (parent * 0x9E3779B1u);
+    return uint32_t(h * seed) >> (32 - BITS);
+  }
+
+  // a route whose literal a path starts with, and the rest
+  // of the path after it
+  struct Match {
+    int route;
+    std::string_view rest;
+  };
+  using Matches = std::array<Match, MAX_SEGMENTS>;
+
+  // the routes whose literals `path` starts with, shortest
+  // first; returns how many
+  size_t match(std::string_view path, Matches& found) const {
+    size_t count = 0;
+    uint16_t node = 0;
+    std::string_view segment;
+    for (std::string_view at = path; next_literal(at, segment);) {
+      int e = slots[slot(node, segment, seed)] - 1;
+      if (e < 0 || edges[e].parent != node || edges[e].segment != segment)
+        break;
+      node = uint16_t(e + 1);
+      if (node_route[node] >= 0)
+        found[count++] = Match{node_route[node], at};
+    }
+    return count;
+  }
+
+  // runs the grammar of the longest matching route on the rest
+  // of `path`, passing it `args`, then the next longest if
+  // that fails, and so on; the index of the route that parsed,
+  // or -1
+  template <typename... Args>
+  int dispatch(std::string_view path, Args&... args) const {
+    Matches found;
+    size_t n = match(path, found);
+    if (n == 1)  // nothing to fall back to
+      return parse_rest(found[0], args...) ? found[0].route : -1;
+    while (n-- > 0) {
+      // into copies, so a grammar that fails partway leaves
+      // nothing behind for the next one or the caller
+      std::tuple<Args...> scratch{args...};
+      bool ok = std::apply(
+          [&](Args&... copies) { return parse_rest(found[n], copies...); },
+          scratch);
+      if (ok) {
+        std::tie(args...) = std::move(scratch);
+        return found[n].route;
+      }
+    }
+    return -1;
+  }
+
+ private:
+  template <size_t... I>
+  constexpr void init(std::index_sequence<I...>) {
+    (add(I, std::get<I>(routes).literal), ...);
+    for (;; seed += 2) {
+      if (seed > (1u << 20))
+        throw std::invalid_argument("no perfect hash for these routes");
+      slots = {};
+      size_t e = 0;
+      for (; e < edge_count &&
+             !slots[slot(edges[e].parent, edges[e].segment, seed)];
+           ++e)
+        slots[slot(edges[e].parent, edges[e].segment, seed)] = uint16_t(e + 1);
+      if (e == edge_count)
+        return;
+    }
+  }
+
+  // adds the nodes for `literal` that aren't there yet
+  constexpr void add(size_t route, std::string_view literal) {
+    uint16_t node = 0;
+    std::string_view segment;
+    std::string_view at = literal;
+    size_t depth = 0;
+    while (next_literal(at, segment)) {
+      if (++depth > MAX_SEGMENTS)
+        throw std::invalid_argument("route has too many segments");
+      size_t e = 0;
+      while (e < edge_count &&
+             (edges[e].parent != node || edges[e].segment != segment))
+        ++e;
+      if (e == edge_count)
+        edges[edge_count++] = Edge{node, segment};
+      node = uint16_t(e + 1);
+    }
+    if (!at.empty() || node == 0)
+      throw std::invalid_argument("a route is '/' and literal segments");
+    if (node_route[node] >= 0)
+      throw std::invalid_argument("repeated route");
+    node_route[node] = int16_t(route);
+  }
+
+  template <typename... Args>
+  bool parse_rest(const Match& m, Args&... args) const {
+    PathParse parse = {m.rest};
+    bool ok = false;
+    dispatch(m.route, parse, ok, std::index_sequence_for<Fns...>{}, args...);
+    return ok;
+  }
+
+  template <size_t... I, typename... Args>
+  void dispatch(size_t i, PathParse& parse, bool& ok,
+                std::index_sequence<I...>, Args&... args) const {
+    ((i == I ? void(ok = std::get<I>(routes).fn(parse, args...)) : void()),
+     ...);
+  }
+};
+
+template <typename Fn1, typename Fn2>
+constexpr auto operator|(Route<Fn1> a, Route<Fn2> b) {
+  return Router<Fn1, Fn2>{std::make_tuple(a, b)};
+}
+template <typename... Fns, typename Fn>
+constexpr auto operator|(const Router<Fns...>& router, Route<Fn> r) {
+  return Router<Fns..., Fn>{std::tuple_cat(router.routes, std::make_tuple(r))};
+}
+}  // namespace dsl
+}  // namespace darr
@@ -0,0 +1,79 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "parser.h"
+
+/*
+ * Times parse_person's chain of operator/ calls against the
+ * same grammar fused into one pass, over paths that all parse
+ * and over paths that fail early or late.
+ *
+ *     grammar_bench [PATHS]
+ */
+
+namespace darr {
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// `paths` paths, the given share of them failing at the last
+// name (missing) or at the age (not a number)
+std::vector<std::string> corpus(size_t paths, double early, double late) {
+  std::mt19937_64 rng{48};
+  std::uniform_real_distribution<double> roll;
+  std::vector<std::string> out;
+  for (size_t i = 0; i < paths; ++i) {
+    std::string path = "/first" + std::to_string(rng() % 100000);
+    double r = roll(rng);
+    if (r < early) {
+      out.push_back(path);
+      continue;
+    }
+    path += "/last" + std::to_string(rng() % 1000);
+    path += r < early + late ? "/old" : "/" + std::to_string(rng() % 100);
+    out.push_back(path);
+  }
+  return out;
+}
+
+template <typename ParseFn>
+double ns_per_path(const std::vector<std::string>& paths, ParseFn parse,
+                   size_t& parsed) {
+  Person person;
+  parsed = 0;
+  auto start = Clock::now();
+  for (int round = 0; round < 5; ++round)
+    for (auto& path : paths)
+      parsed += parse(person, path);
+  parsed /= 5;
+  auto ns = std::chrono::duration<double, std::nano>(Clock::now() - start);
+  return ns.count() / (5 * paths.size());
+}
+
+int run(size_t paths) {
+  struct Case {
+    const char* name;
+    double early, late;
+  };
+  std::printf("%-14s %10s %10s %8s\n", "paths", "chain ns", "fused ns",
+              "speedup");
+  for (auto c : {Case{"all parse", 0, 0}, Case{"half early", 0.5, 0},
+                 Case{"half late", 0, 0.5}, Case{"all early", 1, 0}}) {
+    auto input = corpus(paths, c.early, c.late);
+    size_t chain_parsed, fused_parsed;
+    bool (*chain)(Person&, std::string_view) = parse_person;
+    double a = ns_per_path(input, chain, chain_parsed);
+    double b = ns_per_path(input, parse_person_fused, fused_parsed);
+    std::printf("%-14s %10.1f %10.1f %7.2fx%s\n", c.name, a, b, a / b,
+                chain_parsed == fused_parsed ? "" : "  (disagree!)");
+  }
+  return 0;
+}
+}  // namespace
+}  // namespace darr
+
+int main(int argc, char** argv) {
+  return darr::run(argc > 1 ? std::stoul(argv[1]) : 1000000);
+}
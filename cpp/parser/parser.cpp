@@ -1,244 +1,143 @@
-#include <charconv>
-#include <chrono>
-#include <optional>
-
 #include "parser.h"
 
-/*
- * This class implements a static parser for delimited text
- * which allows grammars to be expressively defined.  All
- * calls are static and can be optimized and inlined by
- * the compiler.
- *
- * The following defines a parser which parses slash-delimited
- * list of strings (like a URL) into an object.
- *
- *     PathParse p = {path};
- *     start_parse(p, person, "/")        //
- *         / &Person::mutable_first_name  //
- *         / &Person::mutable_last_name   //
- *         / optional(&Person::set_age)   //
- *         ;
- *
- * It works by implementing `operator/()` for a few method
- * signatures, and then doing string-to-object conversion
- * to call the object's setters.
- *
- * For example "/ &Person::mutable_last_name" will call
- *
- *    PathContext<Person> operator/(
- *      PathContext<Person>& ctx,      // our object
- *      std::string* (Person::*)()     // function pointer
- *    )
- *
- * And then it's just recursively defined from there.  It's
- * probably best to start at the bottom of the file and
- * work upwards.
- */
+#include "grammar.h"
 
-namespace {
+namespace darr {
+using namespace dsl;
 
-//
-// --- CONVERTERS ----------------
-//
-// Functions which convert raw text to
-//
-template <typename T>
-std::optional<T> try_to(std::string_view);
-
-template <>
-std::optional<std::string> try_to(std::string_view segment) {
-  return std::string{segment};
-}
-template <>
-std::optional<uint32_t> try_to(std::string_view segment) {
-  std::optional<uint32_t> opt{};
-  uint32_t v;
-  if (auto r = std::from_chars(segment.begin(), segment.end(), v);
-      r.ec == std::errc()) {
-    opt = v;
-  }
-  return opt;
-}
+namespace {
+// a Person, or a ColumnRow<Person>
+template <typename TargetT>
+bool parse_person(PathParse& p, TargetT& person) {
+  start_parse(p, person, "/")        //
+      / &Person::mutable_first_name  //
+      / &Person::mutable_last_name   //
+      / optional(&Person::set_age)   //
+      ;
 
-//
-// --- UTIL ----------------
-//
-bool remove_prefix(std::string_view& tgt, const std::string_view prefix) {
-  if (tgt.size() >= prefix.size() &&
-      tgt.compare(0, prefix.size(), prefix) == 0) {
-    tgt.remove_prefix(prefix.size());
-    return true;
-  }
-  return false;
+  return p.ok;
 }
 
-std::string_view split_step(std::string_view& tgt, char delimiter) {
-  auto make_sv = [](const char* b, const char* e) {
-    size_t sz = std::distance(b, e);
-    return std::string_view{b, sz};
-  };
-
-  auto it = std::find(tgt.begin(), tgt.end(), delimiter);
-  auto result = make_sv(tgt.begin(), it);
-
-  if (it != tgt.end())
-    it = std::next(it);
-  tgt = make_sv(it, tgt.end());
+bool parse_person(PathParse& p, PersonView& person) {
+  start_parse(p, person, "/")             //
+      / &PersonView::set_first_name     //
+      / &PersonView::set_last_name      //
+      / optional(&PersonView::set_age)  //
+      ;
 
-  return result;
+  return p.ok;
 }
+}  // namespace
 
-//
-// --- TYPES -----------------
-//
-
-// PathParse: holds the path as it's consumed
-struct PathParse {
-  std::string_view path;
-  bool ok{true};
-};
-
-// ParseContext: binds the parse to a target object
-template <typename TargetT>
-struct ParseContext {
-  PathParse& parse;
-  TargetT& target;
-};
-
-// IntegralField / StringField: a pointer to a field
-template <typename T, typename V,
-          typename std::enable_if<std::is_integral<V>::value, int>::type = 0>
-using IntegralFn = void (T::*)(V);
-template <typename T, typename V,
-          typename std::enable_if<std::is_integral<V>::value, int>::type = 0>
-struct IntegralField {
-  IntegralField(void (T::*fn)(V), bool req) : setter{fn}, required{req} {}
-  IntegralFn<T, V> setter;
-  bool required{true};
-};
-
-// IntegralField / StringField: a pointer to a field
-template <typename T>
-using StringFn = std::string* (T::*)();
-template <typename T>
-struct StringField {
-  StringField(std::string* (T::*fn)(), bool req) : getter{fn}, required{req} {}
-  StringFn<T> getter;
-  bool required{true};
-};
-
-//
-// --- FACTORIES ----------------
-//
-
-template <typename T>
-ParseContext<T> parse_into(PathParse& parse, T& target) {
-  return {parse, target};
-}
-template <typename T, size_t N>
-ParseContext<T> start_parse(PathParse& parse, T& target,
-                            const char (&prefix)[N]) {
-  parse.ok = remove_prefix(parse.path, prefix);
-  return parse_into(parse, target);
-}
-template <typename T, typename V>
-auto required(IntegralFn<T, V> setter) {
-  return IntegralField<T, V>(setter, true);
-}
-template <typename DefT>
-auto required(DefT&& t) {
-  return std::forward<DefT>(t);  // required is default
-}
-template <typename T, typename V>
-auto optional(IntegralFn<T, V> setter) {
-  return IntegralField<T, V>(setter, false);
-}
-template <typename T>
-auto optional(StringFn<T> getter) {
-  return StringField<T>(getter, false);
+bool parse_person(Person& person, std::string_view path) {
+  PathParse p = {path};
+  return parse_person(p, person);
 }
 
-//
-// --- PARSERS ----------------
-// These take a segment of the path and set the field
-// in the protobuf object
-// ---
-//
-
-#define CALL_MEMBER_FN(object, ptrToMember) ((object).*(ptrToMember))
-template <typename T, typename V>
-void parse_segment(ParseContext<T>& ctx, IntegralField<T, V> fld,
-                   std::string_view segment) {
-  if (ctx.parse.ok && !segment.empty()) {
-    if (auto v = try_to<V>(segment)) {
-      CALL_MEMBER_FN(ctx.target, fld.setter)(*v);
-    } else {
-      ctx.parse.ok = false;
-    }
-  } else if (fld.required) {
-    ctx.parse.ok = false;
-  }
+bool parse_person(Person& person, std::string_view path,
+                  const StructuralIndex& index) {
+  PathParse p = {path, true, &index};
+  return parse_person(p, person);
 }
 
-template <typename T>
-void parse_segment(ParseContext<T>& ctx, StringField<T>& fld,
-                   std::string_view segment) {
-  if (ctx.parse.ok && !segment.empty()) {
-    auto* str = CALL_MEMBER_FN(ctx.target, fld.getter)();
-    str->assign(segment.begin(), segment.end());
-  } else if (fld.required) {
-    ctx.parse.ok = false;
-  }
-}
-#undef CALL_MEMBER_FN
-
-//
-// --- OPERATORS ------------------
-//
-
-template <typename T, typename FieldT1, typename FieldT2>
-ParseContext<T>& operator/(ParseContext<T>& ctx,
-                           std::pair<FieldT1, FieldT2> pair) {
-  auto s = split_step(ctx.parse.path, '/');  // pull "a,b" from "a,b/c/d"
-  parse_segment(ctx, pair.first, split_step(s, ','));  // pull "a" from "a,b"
-  parse_segment(ctx, pair.second, s);
-  return ctx;
-}
+namespace {
+constexpr auto fused_person = grammar("/")   //
+    / &Person::mutable_first_name            //
+    / &Person::mutable_last_name             //
+    / optional(&Person::set_age);            //
+}  // namespace
 
-template <typename T, typename FieldT>
-ParseContext<T>& operator/(ParseContext<T>& ctx, FieldT&& fld) {
-  parse_segment(ctx, fld, split_step(ctx.parse.path, '/'));
-  return ctx;
+bool parse_person_fused(Person& person, std::string_view path) {
+  PathParse p = {path};
+  return fused_person.parse(p, person);
 }
 
-template <typename T, typename V>
-ParseContext<T>& operator/(ParseContext<T>& ctx, IntegralFn<T, V> setter) {
-  return ctx / IntegralField<T, V>{setter, true};  // required by default
+bool parse_person_tsv(Person& person, std::string_view record) {
+  PathParse p = {record};
+  start_parse<'\t'>(p, person, "")  //
+      / &Person::mutable_first_name  //
+      / &Person::mutable_last_name   //
+      / optional(&Person::set_age)   //
+      ;
+  return p.ok;
 }
 
-template <typename T>
-ParseContext<T>& operator/(ParseContext<T>& ctx, StringFn<T> getter) {
-  return ctx / StringField<T>{getter, true};  // required by default
-}
+namespace {
+constexpr auto person_keys = key("first", &Person::mutable_first_name)  //
+                           & key("last", &Person::mutable_last_name)    //
+                           & key("age", optional(&Person::set_age));    //
+}  // namespace
 
-template <typename T, typename SetterT>
-ParseContext<T>& operator/(ParseContext<T>&& ctx, SetterT&& setter) {
-  return ctx / std::forward<SetterT>(setter);
+bool parse_person_query(Person& person, std::string_view query_string,
+                        bool strict) {
+  PathParse p = {query_string};
+  auto repeated = strict ? Repeated::fail : Repeated::last;
+  auto unknown = strict ? Unknown::fail : Unknown::skip;
+  query(p, person, "?", repeated, unknown) & person_keys;
+  return p.ok;
 }
+
+namespace {
+constexpr auto person_routes =
+    route("/v1/person",
+          [](PathParse& p, Person& person) { return parse_person(p, person); })
+    | route("/v1/person/me",
+            [](PathParse& p, Person& person) {
+              if (!p.path.empty())
+                return false;
+              *person.mutable_first_name() = "Christopher";
+              *person.mutable_last_name() = "Robin";
+              return true;
+            })
+    | route("/v1/search",
+            [](PathParse& p, Person& person) {
+              query(p, person, "?") & person_keys;
+              return p.ok;
+            })
+    | route("/health", [](PathParse& p, Person&) { return p.path.empty(); });
 }  // namespace
 
-namespace darr {
+int route_person(std::string_view path, Person& person) {
+  return person_routes.dispatch(path, person);
+}
 
-bool parse_person(Person& person, std::string_view path) {
+bool parse_person(PersonView& person, std::string_view path) {
   PathParse p = {path};
-  start_parse(p, person, "/")        //
-      / &Person::mutable_first_name  //
-      / &Person::mutable_last_name   //
-      / optional(&Person::set_age)   //
-      ;
+  return parse_person(p, person);
+}
 
-  return p.ok;
+bool parse_person(PersonView& person, std::string_view path,
+                  StringArena& arena) {
+  PathParse p = {path};
+  p.arena = &arena;
+  return parse_person(p, person);
+}
+
+size_t parse_person_batch(std::string_view source,
+                          const std::string_view* inputs, size_t count,
+                          ColumnBatch& out) {
+  out.reset(source, count);
+  // one pass over the span the inputs cover, rather than a
+  // scan per segment; its memory is kept for the thread's next
+  // batch.  Not the whole source, which may be a mapped file.
+  const char* begin = nullptr;
+  const char* end = nullptr;
+  for (size_t i = 0; i < count; ++i) {
+    if (!begin || inputs[i].data() < begin) begin = inputs[i].data();
+    if (!end || inputs[i].data() + inputs[i].size() > end)
+      end = inputs[i].data() + inputs[i].size();
+  }
+  thread_local StructuralIndex index;
+  index.build({begin, size_t(end - begin)}, "/");
+  size_t parsed = 0;
+  for (size_t i = 0; i < count; ++i) {
+    PathParse p = {inputs[i], true, &index};
+    ColumnRow<Person> row{out, i};
+    bool ok = parse_person(p, row);
+    out.set_ok(i, ok);
+    parsed += ok;
+  }
+  return parsed;
 }
 
 }  // namespace darr
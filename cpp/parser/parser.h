@@ -1,6 +1,13 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <string_view>
+
+#include "arena.h"
+#include "columns.h"
+#include "records.h"
+#include "structural.h"
 
 namespace darr {
 
@@ -16,16 +23,102 @@ class Person {
   uint32_t age() const { return age_; }
   void set_age(uint32_t v) { age_ = v; }
 
+  // back to new, keeping the strings' memory
+  void clear() {
+    first_name_.clear();
+    last_name_.clear();
+    age_ = 2;
+  }
+
  private:
   std::string first_name_;
   std::string last_name_;
   uint32_t age_{2};  // default age ;)
 };
 
+// The same fields as views, which borrow from the parsed text
+// (or from a StringArena), so filling one allocates nothing
+class PersonView {
+ public:
+  std::string_view first_name() const { return first_name_; }
+  void set_first_name(std::string_view v) { first_name_ = v; }
+
+  std::string_view last_name() const { return last_name_; }
+  void set_last_name(std::string_view v) { last_name_ = v; }
+
+  uint32_t age() const { return age_; }
+  void set_age(uint32_t v) { age_ = v; }
+
+  void clear() { *this = PersonView{}; }
+
+ private:
+  std::string_view first_name_;
+  std::string_view last_name_;
+  uint32_t age_{2};
+};
+
 
 /*
  * Parses a string of the form "/first/last/age" where age
  */
 bool parse_person(Person&, std::string_view src);
 
+/*
+ * The same, for a `src` inside text that's been indexed for
+ * '/' (say a batch of paths, indexed once), which then finds
+ * each segment from the index rather than by scanning.
+ */
+bool parse_person(Person&, std::string_view src, const StructuralIndex&);
+
+/*
+ * The same as parse_person(Person&, src), but with the grammar
+ * fused into one pass, which stops at the first field that
+ * fails.
+ */
+bool parse_person_fused(Person&, std::string_view src);
+
+/*
+ * Parses a tab-separated record "first\tlast[\tage]".
+ */
+bool parse_person_tsv(Person&, std::string_view src);
+
+/*
+ * Parses a query string "?first=..&last=..&age=.." with the
+ * keys in any order, where age is optional.  Unknown keys are
+ * skipped and a repeated key's last value wins, unless
+ * `strict`, when either fails the parse.
+ */
+bool parse_person_query(Person&, std::string_view src, bool strict = false);
+
+/*
+ * Routes `path` to one of
+ *
+ *     0  /v1/person/first/last[/age]
+ *     1  /v1/person/me
+ *     2  /v1/search?first=..&last=..[&age=..]
+ *     3  /health
+ *
+ * and fills `person` from the rest of it.  Returns which, or
+ * -1 if none matched or the rest didn't parse.
+ */
+int route_person(std::string_view path, Person& person);
+
+/*
+ * The same, into views of `src`, which must outlive `person`;
+ * or with `arena`, into copies there, which must.
+ */
+bool parse_person(PersonView&, std::string_view src);
+bool parse_person(PersonView&, std::string_view src, StringArena& arena);
+
+/*
+ * Parses `count` inputs, each lying within `source`, into
+ * columns: first_name and last_name as spans of `source`,
+ * then age as uint32_t.  Returns how many parsed.  The span
+ * of `source` the inputs cover is indexed once for '/', and
+ * each input split from that.
+ */
+size_t parse_person_batch(std::string_view source,
+                          const std::string_view* inputs, size_t count,
+                          ColumnBatch& out);
+
 }  // namespace darr
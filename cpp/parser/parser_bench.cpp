@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "alloc_count.h"
+#include "bench.h"
+#include "parser.h"
+#include "request_url.h"
+
+/*
+ * Benchmarks each registered grammar over a corpus made to
+ * its description, and reports per record: time, input bytes
+ * per cycle, the branch-miss rate and heap allocations.
+ *
+ *     parser_bench [--records N] [--seed N] [--fail RATIO]
+ *                  [--rounds N] [--grammar NAME] [--list]
+ *
+ * The same seed makes the same corpus, so two builds can be
+ * compared record for record.  Each grammar runs --rounds
+ * times (5) over its corpus and the fastest round is shown,
+ * after one to warm up.
+ */
+
+namespace darr {
+namespace {
+using Clock = std::chrono::steady_clock;
+using namespace bench;
+
+struct Options {
+  size_t records{200000};
+  uint64_t seed{1};
+  double fail_ratio{0.1};
+  int rounds{5};
+  std::string grammar;
+  bool list{false};
+};
+
+void usage() {
+  std::cerr << "usage: parser_bench [--records N] [--seed N] [--fail RATIO]\n"
+               "                    [--rounds N] [--grammar NAME] [--list]\n";
+  exit(2);
+}
+
+Options parse_args(int argc, char** argv) {
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--records" && has_value) {
+      opts.records = std::stoul(argv[++i]);
+    } else if (arg == "--seed" && has_value) {
+      opts.seed = std::stoull(argv[++i]);
+    } else if (arg == "--fail" && has_value) {
+      opts.fail_ratio = std::stod(argv[++i]);
+    } else if (arg == "--rounds" && has_value) {
+      opts.rounds = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--grammar" && has_value) {
+      opts.grammar = argv[++i];
+    } else if (arg == "--list") {
+      opts.list = true;
+    } else {
+      usage();
+    }
+  }
+  return opts;
+}
+
+// --- the grammars ---
+// Each parses into a target that lives as long as the
+// benchmark and is cleared per record, as a server would.
+
+Person person;
+PersonView view;
+SomeRequest request;  // the thread's one SomeRequest
+
+struct Grammar {
+  const char* name;
+  bool (*parse)(std::string_view);
+  CorpusSpec spec;
+};
+
+CorpusSpec person_spec(std::string prefix, char delimiter) {
+  CorpusSpec spec;
+  spec.prefix = std::move(prefix);
+  spec.delimiter = delimiter;
+  spec.segments = {text(3, 12), text(3, 16), number(0, 120, 0.8)};
+  return spec;
+}
+
+std::vector<Grammar> registered() {
+  std::vector<Grammar> grammars;
+  auto add = [&](const char* name, bool (*parse)(std::string_view),
+                 CorpusSpec spec) {
+    grammars.push_back(Grammar{name, parse, std::move(spec)});
+  };
+
+  add("person",
+      [](std::string_view s) {
+        person.clear();
+        return parse_person(person, s);
+      },
+      person_spec("/", '/'));
+  add("person_fused",
+      [](std::string_view s) {
+        person.clear();
+        return parse_person_fused(person, s);
+      },
+      person_spec("/", '/'));
+  add("person_view",
+      [](std::string_view s) {
+        view.clear();
+        return parse_person(view, s);
+      },
+      person_spec("/", '/'));
+  add("person_tsv",
+      [](std::string_view s) {
+        person.clear();
+        return parse_person_tsv(person, s);
+      },
+      person_spec("", '\t'));
+  add("person_route",
+      [](std::string_view s) {
+        person.clear();
+        return route_person(s, person) == 0;
+      },
+      person_spec("/v1/person/", '/'));
+
+  CorpusSpec query = person_spec("?", '&');
+  query.segments = {keyed("first", query.segments[0]),
+                    keyed("last", query.segments[1]),
+                    keyed("age", query.segments[2])};
+  std::swap(query.segments[0], query.segments[2]);  // any order will do
+  add("person_query",
+      [](std::string_view s) {
+        person.clear();
+        return parse_person_query(person, s);
+      },
+      query);
+
+  CorpusSpec url;
+  url.segments = {text(3, 6), text(1, 5), text(8, 40)};
+  add("request_url",
+      [](std::string_view s) {
+        request.clear();
+        return parse_request_url(request, s);
+      },
+      url);
+  return grammars;
+}
+
+struct Result {
+  double ns{0};  // per record
+  Counters::Sample counters;
+  size_t parsed{0};
+  size_t allocations{0};
+};
+
+Result measure(const Grammar& g, const Corpus& corpus, int rounds) {
+  Counters counters;
+  Result best;
+  for (int round = 0; round <= rounds; ++round) {
+    Result r;
+    size_t before = allocations;
+    counters.start();
+    auto start = Clock::now();
+    for (auto record : corpus.records)
+      r.parsed += g.parse(record);
+    auto elapsed = Clock::now() - start;
+    r.counters = counters.stop();
+    r.allocations = allocations - before;
+    r.ns = std::chrono::duration<double, std::nano>(elapsed).count() /
+           corpus.records.size();
+    if (round > 0 && (best.ns == 0 || r.ns < best.ns))
+      best = r;  // round zero warms up
+  }
+  return best;
+}
+
+int run(const Options& opts) {
+  auto grammars = registered();
+  if (opts.list) {
+    for (auto& g : grammars)
+      std::cout << g.name << "\n";
+    return 0;
+  }
+
+  std::printf("seed %llu, %zu records, %.0f%% broken\n",
+              (unsigned long long)opts.seed, opts.records,
+              opts.fail_ratio * 100);
+  std::printf("%-14s %8s %8s %10s %9s %10s %8s\n", "grammar", "parsed",
+              "ns/rec", "bytes/cyc", "br-miss%", "miss/rec", "allocs");
+  bool found = false;
+  for (auto& g : grammars) {
+    if (!opts.grammar.empty() && opts.grammar != g.name)
+      continue;
+    found = true;
+    CorpusSpec spec = g.spec;
+    spec.records = opts.records;
+    spec.seed = opts.seed;
+    spec.fail_ratio = opts.fail_ratio;
+    Corpus corpus = generate(spec);
+
+    Result r = measure(g, corpus, opts.rounds);
+    auto& c = r.counters;
+    size_t n = corpus.records.size();
+    std::printf("%-14s %7.1f%% %8.1f", g.name, 100.0 * r.parsed / n, r.ns);
+    // no perf events and no TSC (off x86) leaves no cycles
+    if (c.cycles)
+      std::printf(" %9.2f%s", double(corpus.bytes) / c.cycles,
+                  c.tsc ? "t" : " ");
+    else
+      std::printf(" %10s", "-");
+    if (c.has_branches && c.branches)
+      std::printf(" %9.2f %10.3f", 100.0 * c.misses / c.branches,
+                  double(c.misses) / n);
+    else
+      std::printf(" %9s %10s", "-", "-");
+    std::printf(" %8.3f\n", double(r.allocations) / n);
+  }
+  if (!found) {
+    std::cerr << "parser_bench: no grammar " << opts.grammar << "\n";
+    return 1;
+  }
+  std::printf("(bytes/cyc marked t are per TSC tick, without perf events)\n");
+  return 0;
+}
+}  // namespace
+}  // namespace darr
+
+int main(int argc, char** argv) {
+  return darr::run(darr::parse_args(argc, argv));
+}
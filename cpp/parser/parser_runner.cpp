@@ -1,8 +1,36 @@
 #include "parser.h"
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <random>
 #include <iostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "alloc_count.h"
+#include "chunked.h"
+#include "convert.h"
+#include "grammar.h"
+#include "request_url.h"
 
 namespace darr {
+template <typename A, typename B>
+void expect_eq(const A& a, const B& b, const char* a_str, const char* b_str) {
+  if (!(a == b)) {
+    std::cout << "EXPECTED " << a_str << " == " << b_str << "\n"
+              << "     WAS " << a << " == " << b << "\n";
+  }
+}
+#define EXPECT_EQ(a, b) expect_eq(a, b, #a, #b);
+
 void run_parse(std::string_view txt) {
   Person p = {};
   bool ok = parse_person(p, txt);
@@ -12,6 +40,524 @@ void run_parse(std::string_view txt) {
             << "   last: " << p.last_name() << "\n"         //
             << "    age: " << p.age() << "\n";
 }
+// a batch of paths indexed in one pass, each parsed from the
+// index; it has to agree with parsing them one at a time
+void run_indexed() {
+  std::string batch;
+  for (int i = 0; i < 100; ++i) {
+    batch += "/first" + std::to_string(i) + "/last";
+    batch += std::string(i % 70, 'x');  // to cross 64-byte words
+    if (i % 3)
+      batch += "/" + std::to_string(i);
+    if (i % 7 == 0)
+      batch += "/nan";
+    batch += "\n";
+  }
+  StructuralIndex index{batch, "/,\n"};
+
+  int parsed = 0, agreed = 0;
+  const char* end = batch.data() + batch.size();
+  for (const char* line = batch.data(); line < end;) {
+    const char* eol = index.find(line, end, '\n');
+    std::string_view path{line, size_t(eol - line)};
+    Person a, b;
+    bool ok = parse_person(a, path, index);
+    parsed += ok;
+    agreed += ok == parse_person(b, path) && a.first_name() == b.first_name() &&
+              a.last_name() == b.last_name() && a.age() == b.age();
+    line = eol + 1;
+  }
+  EXPECT_EQ(agreed, 100);
+  EXPECT_EQ(parsed, 95);  // "nan" is the age in five of them
+
+  int same = 0;
+  for (const char* from = batch.data(); from < end; ++from)
+    same += index.find(from, end, '/') == std::find(from, end, '/');
+  EXPECT_EQ(same, int(batch.size()));
+  std::cout << "indexed batch: " << parsed << " of 100 parsed\n";
+}
+
+// the same paths as columns, with no Person in sight
+void run_columns() {
+  std::string source = "/Christopher/Robin/5\n/Tyler/Robin\n/Piglet\n"
+                       "/Winnie/the/Poo\n/Tigger/Tiger/44";
+  std::vector<std::string_view> inputs;
+  for (size_t at = 0, eol; at < source.size(); at = eol + 1) {
+    eol = std::min(source.find('\n', at), source.size());
+    inputs.push_back(std::string_view{source}.substr(at, eol - at));
+  }
+
+  ColumnBatch batch;
+  size_t parsed = parse_person_batch(source, inputs.data(), inputs.size(), batch);
+  EXPECT_EQ(parsed, 3u);
+  EXPECT_EQ(batch.rows(), 5u);
+  EXPECT_EQ(batch.columns(), 3u);
+  EXPECT_EQ(batch.ok(1) && !batch.ok(2) && !batch.ok(3), true);
+  EXPECT_EQ(batch.string(0, 4), "Tigger");
+  EXPECT_EQ(batch.string(1, 0), "Robin");
+  EXPECT_EQ(batch.values<uint32_t>(2)[4], 44u);
+  // Tyler has no age, and Piglet stopped at the last name
+  EXPECT_EQ(batch.valid(2, 1), false);
+  EXPECT_EQ(batch.valid(0, 2) && !batch.valid(1, 2), true);
+
+  // only the span the inputs cover is indexed, whatever order
+  // they come in
+  ColumnBatch some;
+  std::string_view backwards[] = {inputs[4], inputs[1]};
+  EXPECT_EQ(parse_person_batch(source, backwards, 2, some), 2u);
+  EXPECT_EQ(some.string(0, 0), "Tigger");
+  EXPECT_EQ(some.values<uint32_t>(2)[0], 44u);
+  EXPECT_EQ(some.string(1, 1), "Robin");
+
+  std::cout << "columns:\n";
+  for (size_t row = 0; row < batch.rows(); ++row) {
+    std::cout << "  " << (batch.ok(row) ? "ok " : "bad");
+    for (size_t col = 0; col < 2; ++col)
+      std::cout << " " << (batch.valid(col, row) ? batch.string(col, row) : "-");
+    std::cout << " " << batch.values<uint32_t>(2)[row] * batch.valid(2, row)
+              << "\n";
+  }
+}
+
+// a file parsed in tiny chunks across threads has to come
+// back in file order, agreeing with a serial parse
+void run_chunked() {
+  std::string text;
+  for (int i = 0; i < 1000; ++i)
+    text += "/first" + std::to_string(i) + "/last" +
+            (i % 9 ? "/" + std::to_string(i % 100) : "/old") + "\n";
+  std::string path = "/tmp/parser_runner." + std::to_string(getpid());
+  std::ofstream{path} << text;
+  MappedFile file{path};
+  EXPECT_EQ(file.text() == text, true);
+
+  struct Chunk {
+    std::string first;  // of the chunk's first line
+    int lines{0};
+    int parsed{0};
+  };
+  ChunkOptions opts;
+  opts.chunk_size = 100;
+  opts.threads = 4;
+  auto chunks = parse_chunks(file.text(), [](std::string_view chunk) {
+    Chunk c;
+    for_each_line(chunk, [&](std::string_view line) {
+      Person p;
+      c.parsed += parse_person(p, line);
+      if (c.lines++ == 0)
+        c.first = p.first_name();
+    });
+    return c;
+  }, opts);
+  unlink(path.c_str());
+
+  int lines = 0, parsed = 0, ordered = 0;
+  for (auto& c : chunks) {
+    ordered += c.first == "first" + std::to_string(lines);
+    lines += c.lines;
+    parsed += c.parsed;
+  }
+  EXPECT_EQ(lines, 1000);
+  EXPECT_EQ(parsed, 888);  // every ninth has "old" for an age
+  EXPECT_EQ(ordered, int(chunks.size()));
+
+  // and the pool runs every task exactly once
+  std::vector<std::atomic<int>> runs(10000);
+  run_stealing(runs.size(), 8, [&](size_t i) { ++runs[i]; });
+  int once = 0;
+  for (auto& r : runs)
+    once += r == 1;
+  EXPECT_EQ(once, 10000);
+  std::cout << "chunked: " << parsed << " of " << lines << " parsed in "
+            << chunks.size() << " chunks\n";
+}
+
+// views borrow from the input, or from an arena, and
+// neither allocates per parse
+void run_views() {
+  std::string line = "/Christopher-Robin-Milne/Robin/5";
+  PersonView view;
+  Person person;
+  size_t before = allocations;
+  for (int i = 0; i < 100; ++i)
+    parse_person(view, line);
+  EXPECT_EQ(allocations - before, 0u);
+  EXPECT_EQ(view.first_name().data(), line.data() + 1);
+  EXPECT_EQ(view.age(), 5u);
+
+  StringArena arena;
+  EXPECT_EQ(parse_person(view, line, arena), true);
+  before = allocations;
+  for (int i = 0; i < 100; ++i) {
+    arena.clear();
+    parse_person(view, line, arena);
+  }
+  EXPECT_EQ(allocations - before, 0u);
+  EXPECT_EQ(arena.used(), 28u);
+  line.assign(line.size(), '?');  // the copies don't care
+  EXPECT_EQ(view.first_name(), "Christopher-Robin-Milne");
+  EXPECT_EQ(view.last_name(), "Robin");
+
+  std::cout << "views: " << view.first_name() << " " << view.last_name()
+            << " " << view.age() << "\n";
+
+  // and protobuf-style targets still parse, as before
+  EXPECT_EQ(parse_person(person, "/Christopher-Robin-Milne/Robin/5"), true);
+  EXPECT_EQ(parse_person(view, "/Piglet"), false);
+}
+
+// what a converter made of `s`
+template <typename T>
+std::string described(std::from_chars_result r, T v, std::string_view s) {
+  if (r.ec == std::errc::invalid_argument)
+    return "invalid";
+  if (r.ec == std::errc::result_out_of_range)
+    return "overflow";
+  std::string out = std::to_string(v);
+  if (r.ptr != s.data() + s.size())
+    out += " then " + std::string(r.ptr, s.data() + s.size());
+  return out;
+}
+template <typename T>
+std::string convert_str(std::string_view s) {
+  T v{};
+  auto r = convert::parse(s.data(), s.data() + s.size(), v);
+  return described(r, v, s);
+}
+template <typename T>
+std::string hex_str(std::string_view s) {
+  T v{};
+  auto r = convert::parse_hex(s.data(), s.data() + s.size(), v);
+  return described(r, v, s);
+}
+
+// the converters, against known answers, then against
+// from_chars and strtod on random input
+void run_converters() {
+  EXPECT_EQ(convert_str<uint8_t>("255"), "255");
+  EXPECT_EQ(convert_str<uint8_t>("256"), "overflow");
+  EXPECT_EQ(convert_str<uint8_t>("-1"), "invalid");
+  EXPECT_EQ(convert_str<int8_t>("-128"), "-128");
+  EXPECT_EQ(convert_str<int8_t>("-129"), "overflow");
+  EXPECT_EQ(convert_str<int16_t>("-0"), "0");
+  EXPECT_EQ(convert_str<uint32_t>("4294967295"), "4294967295");
+  EXPECT_EQ(convert_str<uint32_t>("4294967296"), "overflow");
+  EXPECT_EQ(convert_str<uint64_t>("18446744073709551615"),
+            "18446744073709551615");
+  EXPECT_EQ(convert_str<uint64_t>("18446744073709551616"), "overflow");
+  EXPECT_EQ(convert_str<int64_t>("-9223372036854775808"),
+            "-9223372036854775808");
+  EXPECT_EQ(convert_str<int64_t>("9223372036854775808"), "overflow");
+  EXPECT_EQ(convert_str<uint64_t>("000000000000000000000000000042"), "42");
+  EXPECT_EQ(convert_str<uint32_t>("12345678x"), "12345678 then x");
+  EXPECT_EQ(convert_str<uint32_t>(""), "invalid");
+  EXPECT_EQ(convert_str<uint32_t>("x1"), "invalid");
+
+  EXPECT_EQ(hex_str<uint32_t>("DEADbeef"), "3735928559");
+  EXPECT_EQ(hex_str<uint32_t>("0xff"), "255");
+  EXPECT_EQ(hex_str<uint32_t>("0x"), "0 then x");
+  EXPECT_EQ(hex_str<uint32_t>("1ffffffff"), "overflow");
+  EXPECT_EQ(hex_str<uint64_t>("ffffffffffffffff"),
+            "18446744073709551615");
+  EXPECT_EQ(hex_str<uint64_t>("10000000000000000"), "overflow");
+  EXPECT_EQ(hex_str<uint8_t>("fg"), "15 then g");
+
+  EXPECT_EQ(convert_str<bool>("true"), "1");
+  EXPECT_EQ(convert_str<bool>("0"), "0");
+  EXPECT_EQ(convert_str<bool>("falsey"), "0 then y");
+  EXPECT_EQ(convert_str<bool>("yes"), "invalid");
+
+  EXPECT_EQ(convert_str<double>("1.5e3"), "1500.000000");
+  EXPECT_EQ(convert_str<double>("-.25"), "-0.250000");
+  EXPECT_EQ(convert_str<double>("2e"), "2.000000 then e");
+  EXPECT_EQ(convert_str<double>("3.5.1"), "3.500000 then .1");
+  EXPECT_EQ(convert_str<double>("1e400"), "overflow");
+  EXPECT_EQ(convert_str<double>("1e-400"), "overflow");
+  EXPECT_EQ(convert_str<double>("."), "invalid");
+  EXPECT_EQ(convert_str<float>("1e39"), "overflow");
+
+  // random integers, some too long and some with a tail
+  std::mt19937_64 rng{44};
+  int ints = 0, int_agreed = 0;
+  for (int i = 0; i < 100000; ++i) {
+    std::string s = rng() % 4 ? "" : "-";
+    for (size_t n = 1 + rng() % 22; n; --n)
+      s += char('0' + rng() % 10);
+    if (rng() % 8 == 0)
+      s += "x9";
+    const char* end = s.data() + s.size();
+    auto agree = [&](auto v) {
+      decltype(v) w{};
+      auto a = convert::parse(s.data(), end, v);
+      auto b = std::from_chars(s.data(), end, w);
+      return a.ec == b.ec && a.ptr == b.ptr && (a.ec != std::errc() || v == w);
+    };
+    ++ints;
+    int_agreed += agree(int8_t{}) && agree(uint16_t{}) && agree(int32_t{}) &&
+                  agree(uint32_t{}) && agree(int64_t{}) && agree(uint64_t{});
+  }
+  EXPECT_EQ(int_agreed, ints);
+
+  // random decimals, which have to round exactly as strtod
+  int floats = 0, float_agreed = 0;
+  for (int i = 0; i < 200000; ++i) {
+    std::string s = rng() % 2 ? "" : "-";
+    size_t digits = 1 + rng() % (i % 4 ? 17 : 24);
+    size_t point = rng() % (digits + 1);
+    for (size_t n = 0; n < digits; ++n) {
+      if (n == point && n)
+        s += '.';
+      s += char('0' + rng() % 10);
+    }
+    if (rng() % 2)
+      s += "e" + std::to_string(int(rng() % 140) - 70);
+    if (i % 3 == 0)
+      s = s.substr(0, s.find('e'));  // Clinger's range, mostly
+    const char* end = s.data() + s.size();
+    double d = 0, d_want = std::strtod(s.c_str(), nullptr);
+    float f = 0, f_want = std::strtof(s.c_str(), nullptr);
+    auto rd = convert::parse(s.data(), end, d);
+    auto rf = convert::parse(s.data(), end, f);
+    ++floats;
+    bool ok = rd.ptr == end && rf.ptr == end &&
+              std::memcmp(&d, &d_want, sizeof(d)) == 0 &&
+              (rf.ec != std::errc() || std::memcmp(&f, &f_want, 4) == 0);
+    float_agreed += ok;
+    if (!ok && floats - float_agreed < 5)
+      std::cout << "  " << s << " gave " << d << " / " << f << "\n";
+  }
+  EXPECT_EQ(float_agreed, floats);
+  std::cout << "converters: " << int_agreed << " integers and " << float_agreed
+            << " decimals agreed\n";
+}
+
+// query strings, in any order, with the edge cases pinned
+void run_query() {
+  auto age = [](std::string_view q, bool strict = false) -> std::string {
+    Person p;
+    if (!parse_person_query(p, q, strict))
+      return "fail";
+    return p.first_name() + " " + p.last_name() + " " + std::to_string(p.age());
+  };
+  EXPECT_EQ(age("?first=Christopher&last=Robin&age=5"), "Christopher Robin 5");
+  EXPECT_EQ(age("?age=44&last=Tiger&first=Tigger"), "Tigger Tiger 44");
+  EXPECT_EQ(age("?first=Tyler&last=Robin"), "Tyler Robin 2");
+  EXPECT_EQ(age("?first=Piglet"), "fail");              // last is required
+  EXPECT_EQ(age("?first=Winnie&last=the&age=Poo"), "fail");
+  EXPECT_EQ(age("?first=&last=Robin"), "fail");         // so it can't be empty
+  EXPECT_EQ(age("first=Tyler&last=Robin"), "fail");     // no '?'
+  EXPECT_EQ(age("?&first=Eeyore&&last=Donkey&"), "Eeyore Donkey 2");
+  EXPECT_EQ(age("?first=Roo&last=Kanga&hat=none"), "Roo Kanga 2");
+  EXPECT_EQ(age("?first=Roo&last=Kanga&hat=none", true), "fail");
+  EXPECT_EQ(age("?first=Roo&last=Kanga&age=7&age=9"), "Roo Kanga 9");
+  EXPECT_EQ(age("?first=Roo&last=Kanga&age=7&age=9", true), "fail");
+  {
+    using namespace dsl;
+    constexpr auto keys = key("first", &Person::mutable_first_name) &
+                          key("age", optional(&Person::set_age));
+    Person p;
+    PathParse parse = {"?age=7&first=Roo&age=9&first=Kanga"};
+    query(parse, p, "?", Repeated::first) & keys;
+    EXPECT_EQ(parse.ok, true);
+    EXPECT_EQ(p.first_name() + " " + std::to_string(p.age()), "Roo 7");
+  }
+  EXPECT_EQ(age("?fir=Roo&last=Kanga&first=Roo&agex=1"), "Roo Kanga 2");
+  std::cout << "query: " << age("?age=44&last=Tiger&first=Tigger") << "\n";
+}
+
+// an integer field can be read as hex, however it's declared
+void run_hex() {
+  using namespace dsl;
+  auto chained = [](std::string_view path) -> std::string {
+    Person p;
+    PathParse parse = {path};
+    start_parse(parse, p, "/") / &Person::mutable_first_name /
+        &Person::mutable_last_name / optional(hex(&Person::set_age));
+    return parse.ok ? p.first_name() + " " + std::to_string(p.age()) : "fail";
+  };
+  EXPECT_EQ(chained("/Tigger/Tiger/2c"), "Tigger 44");
+  EXPECT_EQ(chained("/Tigger/Tiger/0x2C"), "Tigger 44");
+  EXPECT_EQ(chained("/Tigger/Tiger"), "Tigger 2");
+  EXPECT_EQ(chained("/Tigger/Tiger/2g"), "fail");
+
+  constexpr auto fused = grammar("/") / &Person::mutable_first_name /
+                         &Person::mutable_last_name / hex(&Person::set_age);
+  constexpr auto keys = key("first", &Person::mutable_first_name) &
+                        key("age", hex(&Person::set_age));
+  Person p;
+  PathParse parse = {"/Roo/Kanga/ff"};
+  EXPECT_EQ(fused.parse(parse, p) && p.age() == 255, true);
+  parse = {"/Roo/Kanga"};
+  EXPECT_EQ(fused.parse(parse, p), false);  // hex() is required by default
+  parse = {"?age=0x10&first=Roo"};
+  query(parse, p, "?") & keys;
+  EXPECT_EQ(parse.ok && p.age() == 16, true);
+  std::cout << "hex: " << chained("/Tigger/Tiger/0x2C") << "\n";
+}
+
+// one scan of the path picks the grammar
+void run_routes() {
+  auto routed = [](std::string_view path) -> std::string {
+    Person p;
+    int which = route_person(path, p);
+    if (which < 0)
+      return "none";
+    return std::to_string(which) + " " + p.first_name() + " " +
+           p.last_name() + " " + std::to_string(p.age());
+  };
+  EXPECT_EQ(routed("/v1/person/Tigger/Tiger/44"), "0 Tigger Tiger 44");
+  EXPECT_EQ(routed("/v1/person/me"), "1 Christopher Robin 2");  // the longest
+  EXPECT_EQ(routed("/v1/search?last=Robin&first=Tyler"), "2 Tyler Robin 2");
+  EXPECT_EQ(routed("/health"), "3   2");
+  EXPECT_EQ(routed("/health/more"), "none");       // its grammar says no
+  // a grammar that fails falls back to the next-longest match
+  EXPECT_EQ(routed("/v1/person/me/Robin/5"), "0 me Robin 5");
+  EXPECT_EQ(routed("/v1/person/me/again/and/again"), "none");
+  // and a route that's rejected leaves nothing behind
+  Person untouched;
+  untouched.set_age(9);
+  EXPECT_EQ(route_person("/v1/person/me/", untouched), -1);
+  EXPECT_EQ(route_person("/v1/person/me/Robin/old", untouched), -1);
+  EXPECT_EQ(untouched.first_name() + untouched.last_name(), "");
+  EXPECT_EQ(untouched.age(), 9u);
+  EXPECT_EQ(routed("/v1/person/Piglet"), "none");
+  EXPECT_EQ(routed("/v1/personal/a/b"), "none");
+  EXPECT_EQ(routed("/v1"), "none");
+  EXPECT_EQ(routed("/v2/person/a/b"), "none");
+  EXPECT_EQ(routed(""), "none");
+  EXPECT_EQ(routed("v1/person/a/b"), "none");
+  std::cout << "routes: " << routed("/v1/search?first=Roo&last=Kanga&age=1")
+            << "\n";
+}
+
+// TSV records streamed from a buffer and from a pipe, into
+// one reused Person
+void run_records() {
+  Person person;
+  EXPECT_EQ(parse_person_tsv(person, "Tigger\tTiger\t44"), true);
+  EXPECT_EQ(person.age(), 44u);
+  EXPECT_EQ(parse_person_tsv(person, "/Tigger/Tiger/44"), false);
+  EXPECT_EQ(parse_person_tsv(person, "Tigger\t\t44"), false);
+
+  std::string text;
+  for (int i = 0; i < 1000; ++i)
+    text += "Christopher-Robin-Milne\tof-the-Hundred-Acre-Wood" +
+            (i % 10 ? "\t" + std::to_string(i % 100) : std::string{}) +
+            (i % 7 ? "\n" : "\textra\n");
+  text += "Tyler\tRobin";  // with no newline
+
+  auto count = [](RecordReader& in, Person& person, int& ages) {
+    ages = 0;
+    return parse_records(in, person, parse_person_tsv,
+                         [&](const Person& p, bool ok, std::string_view) {
+                           ages += ok && p.age() != 2;
+                         });
+  };
+  int ages;
+  size_t before = allocations;
+  RecordReader buffered{text};
+  // the fifteen with no age and an extra field fail, with
+  // "extra" for an age; of the rest, every tenth has no age
+  // and every hundredth is two, which is the default
+  EXPECT_EQ(count(buffered, person, ages), 986u);
+  EXPECT_EQ(ages, 890);
+  // the strings grow once, and that's all
+  EXPECT_EQ(allocations - before <= 2, true);
+
+  std::string nul = text;
+  std::replace(nul.begin(), nul.end(), '\n', '\0');
+  RecordReader terminated{nul, '\0'};
+  EXPECT_EQ(count(terminated, person, ages), 986u);
+
+  // a pipe, through a buffer smaller than a record
+  int fds[2];
+  if (pipe(fds) != 0)
+    throw std::system_error(errno, std::generic_category(), "pipe");
+  std::thread writer([&] {
+    for (size_t at = 0; at < text.size();) {
+      ssize_t n = write(fds[1], text.data() + at, text.size() - at);
+      if (n <= 0)
+        break;
+      at += n;
+    }
+    close(fds[1]);
+  });
+  RecordReader piped{fds[0], '\n', 16};
+  EXPECT_EQ(count(piped, person, ages), 986u);
+  EXPECT_EQ(ages, 890);
+  writer.join();
+  close(fds[0]);
+  EXPECT_EQ(person.first_name(), "Tyler");
+
+  bool threw = false;
+  try {
+    RecordReader empty{STDIN_FILENO, '\n', 0};  // could never read a byte
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  EXPECT_EQ(threw, true);
+  std::cout << "records: 986 of 1001 parsed from a buffer, NULs and a pipe\n";
+}
+
+// the fused grammar has to agree with the chain
+void run_fused() {
+  std::mt19937_64 rng{48};
+  const char* parts[] = {"", "Christopher", "Robin", "5", "x", "44", "/"};
+  int agreed = 0, parsed = 0;
+  for (int i = 0; i < 10000; ++i) {
+    std::string path = rng() % 10 ? "/" : "";
+    for (size_t n = rng() % 6; n; --n)
+      path += std::string(parts[rng() % 7]) + (rng() % 4 ? "/" : "");
+    Person a, b;
+    bool ok = parse_person(a, path);
+    parsed += ok;
+    agreed += ok == parse_person_fused(b, path) &&
+              (!ok || (a.first_name() == b.first_name() &&
+                       a.last_name() == b.last_name() && a.age() == b.age()));
+  }
+  EXPECT_EQ(agreed, 10000);
+  std::cout << "fused: " << agreed << " agreed, " << parsed << " parsed\n";
+}
+
+// a URL straight into an ipc request, with no strings between
+void run_request() {
+  std::string url = "/GET/AAAA/www.example.com?market=7&country_iso=GB&asn=42";
+  std::vector<uint8_t> buf;
+  {
+    SomeRequest req;
+    size_t before = allocations;
+    EXPECT_EQ(parse_request_url(req, url), true);
+    EXPECT_EQ(allocations - before, 0u);
+    EXPECT_EQ(req.query.method == "GET" && req.query.type == "AAAA", true);
+    EXPECT_EQ(req.query.prefix == "www.example.com", true);
+    EXPECT_EQ(req.location.market, 7u);
+    EXPECT_EQ(req.location.asn, 42u);
+    EXPECT_EQ(req.location.country, 0u);
+    EXPECT_EQ(req.location.country_iso == "GB", true);
+    EXPECT_EQ(bool(req.location.market_iso), false);
+
+    marshalling::write_item(buf, req);
+  }
+  {
+    // and it's a request like any other on the far side
+    SomeRequest req;
+    marshalling::read_item(buf, req);
+    EXPECT_EQ(req.query.prefix == "www.example.com", true);
+    EXPECT_EQ(req.location.country_iso == "GB", true);
+    EXPECT_EQ(req.location.market, 7u);
+  }
+  auto parses = [](std::string_view url) {
+    SomeRequest req;
+    return parse_request_url(req, url);
+  };
+  EXPECT_EQ(parses("/GET/A/example.com"), true);
+  EXPECT_EQ(parses("/GET/A"), false);
+  EXPECT_EQ(parses("/GET/A/example.com?market=seven"), false);
+  EXPECT_EQ(parses("/GET/A/example.com?market=1&market=2"), false);
+  EXPECT_EQ(parses("/GET/A/example.com?colour=red"), true);
+  std::cout << "request: " << url << "\n";
+}
+
 void run() {
   // These will succeed b/c all three fields are set
   run_parse("/Christopher/Robin/5");
@@ -22,6 +568,18 @@ void run() {
   run_parse("/Piglet");
   // This will fail to parse b/c "Poo" is not an int
   run_parse("/Winnie/the/Poo");
+
+  run_indexed();
+  run_columns();
+  run_chunked();
+  run_views();
+  run_converters();
+  run_query();
+  run_hex();
+  run_routes();
+  run_records();
+  run_fused();
+  run_request();
 }
 }  // namespace darr
 
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+/*
+ * Reads a stream of records, each ended by a newline (or a
+ * NUL, or any byte you like), from a buffer or a file
+ * descriptor, and parses each one into the same target.
+ *
+ *     RecordReader in{fd};                 // or {buffer}, '\0'
+ *     Person person;
+ *     parse_records(in, person, parse_person_tsv,
+ *                   [&](const Person& p, bool ok, std::string_view line) {
+ *                     ...
+ *                   });
+ *
+ * Records are views into the buffer, or into the reader's own
+ * buffer for an fd, which is reused as it's refilled; each is
+ * only good until the next.  Once the fd buffer is as big as
+ * the longest record, nothing more is allocated, and the
+ * target is cleared (keeping its memory, like protobuf's
+ * Clear()) rather than made anew, so a record costs only its
+ * parse.
+ */
+
+namespace darr {
+
+class RecordReader {
+ public:
+  // records from `text`, which must outlive the reader
+  explicit RecordReader(std::string_view text, char terminator = '\n')
+      : terminator_{terminator}, fd_{-1}, data_{text} {}
+  // records read from `fd`, which the reader doesn't close;
+  // the buffer starts at `buffer_size` bytes and grows to fit
+  explicit RecordReader(int fd, char terminator = '\n',
+                        size_t buffer_size = 64 << 10)
+      : terminator_{terminator}, fd_{fd}, buffer_(buffer_size) {
+    if (buffer_size == 0)
+      throw std::invalid_argument("record buffer can't be empty");
+  }
+
+  // the next record, without its terminator; false at the end
+  bool next(std::string_view& record) {
+    for (;;) {
+      // an fd reader has no data at first, not even a pointer
+      const void* end = data_.empty() ? nullptr
+                                      : std::memchr(data_.data(), terminator_,
+                                                    data_.size());
+      if (end) {
+        size_t n = static_cast<const char*>(end) - data_.data();
+        record = data_.substr(0, n);
+        data_.remove_prefix(n + 1);
+        return true;
+      }
+      if (!fill()) {
+        // the last record needn't be terminated
+        record = data_;
+        data_ = {};
+        return !record.empty();
+      }
+    }
+  }
+
+ private:
+  // reads more after what's left of data_; false at the end
+  bool fill() {
+    if (fd_ < 0 || eof_)
+      return false;
+    // what's left goes to the front, and if it fills the
+    // buffer, the buffer grows
+    size_t left = data_.size();
+    if (left)
+      std::memmove(buffer_.data(), data_.data(), left);
+    if (left == buffer_.size())
+      buffer_.resize(buffer_.size() * 2);
+    ssize_t n;
+    do {
+      n = ::read(fd_, buffer_.data() + left, buffer_.size() - left);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+      throw std::system_error(errno, std::generic_category(), "read");
+    eof_ = n == 0;
+    data_ = std::string_view{buffer_.data(), left + size_t(n)};
+    return !eof_;
+  }
+
+  char terminator_;
+  int fd_;
+  bool eof_{false};
+  std::vector<char> buffer_;
+  std::string_view data_;  // not yet returned
+};
+
+// Parses every record from `in` into `target` with
+// parse(target, record), then calls fn(target, ok, record);
+// returns how many parsed
+template <typename TargetT, typename ParseFn, typename Fn>
+size_t parse_records(RecordReader& in, TargetT& target, ParseFn&& parse,
+                     Fn&& fn) {
+  size_t parsed = 0;
+  std::string_view record;
+  while (in.next(record)) {
+    target.clear();
+    bool ok = parse(target, record);
+    parsed += ok;
+    fn(static_cast<const TargetT&>(target), ok, record);
+  }
+  return parsed;
+}
+
+}  // namespace darr
@@ -0,0 +1,37 @@
+#include "request_url.h"
+
+#include "grammar.h"
+
+namespace darr {
+using namespace dsl;
+
+namespace {
+using Query = SomeRequest::Query;
+using Location = SomeRequest::Location;
+constexpr auto location_keys =
+    key("market", optional(&Location::market))            //
+    & key("country", optional(&Location::country))        //
+    & key("region", optional(&Location::region))          //
+    & key("state", optional(&Location::state))            //
+    & key("asn", optional(&Location::asn))                //
+    & key("market_iso", optional(&Location::market_iso))  //
+    & key("country_iso", optional(&Location::country_iso));
+}  // namespace
+
+bool parse_request_url(SomeRequest& req, std::string_view url) {
+  size_t q = std::min(url.find('?'), url.size());
+  PathParse p = {url.substr(0, q)};
+  start_parse(p, req.query, "/")  //
+      / &Query::method            //
+      / &Query::type              //
+      / &Query::prefix            //
+      ;
+  if (!p.ok || q == url.size())
+    return p.ok;
+
+  PathParse kv = {url.substr(q)};
+  query(kv, req.location, "?", Repeated::fail) & location_keys;
+  return kv.ok;
+}
+
+}  // namespace darr
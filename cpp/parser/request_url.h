@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string_view>
+
+#include "../ipc/api.h"
+
+namespace darr {
+
+/*
+ * Parses "/method/type/prefix[?market=..&country=..&...]"
+ * straight into an ipc request: the strings are appended to
+ * its string table with no copy in between, and the numbers
+ * go into its fields.  The location keys are market, country,
+ * region, state, asn, market_iso and country_iso, all
+ * optional but none repeated.  Like any StringPtr, those the
+ * URL sets mustn't have been set already.
+ */
+bool parse_request_url(SomeRequest& req, std::string_view url);
+
+}  // namespace darr
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DARR_STRUCTURAL_X86 1
+#endif
+
+/*
+ * A bitmap of where each delimiter falls in a buffer, one
+ * bit per byte, built in a single pass so the grammar can
+ * jump from delimiter to delimiter rather than scanning for
+ * each one.
+ *
+ *     StructuralIndex index;
+ *     index.build(text, "/,");
+ *     const char* slash = index.find(from, end, '/');
+ *
+ * On x86-64 the pass compares 32 bytes at a time with AVX2
+ * if the CPU has it, else 16 at a time with SSE2; elsewhere
+ * it's a byte at a time.  Finding the next delimiter is then
+ * a count of trailing zeros per 64 bytes.
+ */
+
+namespace darr {
+
+class StructuralIndex {
+ public:
+  static constexpr size_t MAX_DELIMITERS = 4;
+
+  StructuralIndex() = default;
+  StructuralIndex(std::string_view text, std::string_view delimiters) {
+    build(text, delimiters);
+  }
+
+  // indexes `text`, which must outlive the index, for up to
+  // MAX_DELIMITERS delimiters
+  void build(std::string_view text, std::string_view delimiters);
+
+  // true if `text` is what we indexed and `delimiter` is in it
+  bool covers(const char* begin, const char* end, char delimiter) const {
+    return begin >= base_ && end <= base_ + size_ && slot(delimiter) >= 0;
+  }
+
+  // the first `delimiter` in [from, end), or end; the range
+  // must be one we cover
+  const char* find(const char* from, const char* end, char delimiter) const {
+    const auto& mask = masks_[slot(delimiter)];
+    size_t pos = from - base_;
+    size_t word = pos / 64;
+    size_t limit = end - base_;
+    if (pos >= limit)
+      return end;
+    uint64_t bits = mask[word] & (~uint64_t(0) << (pos % 64));
+    while (bits == 0) {
+      if (++word * 64 >= limit)
+        return end;
+      bits = mask[word];
+    }
+    size_t hit = word * 64 + __builtin_ctzll(bits);
+    return hit < limit ? base_ + hit : end;
+  }
+
+ private:
+  int slot(char delimiter) const {
+    for (size_t i = 0; i < count_; ++i)
+      if (delimiters_[i] == delimiter)
+        return int(i);
+    return -1;
+  }
+
+  const char* base_{nullptr};
+  size_t size_{0};
+  char delimiters_[MAX_DELIMITERS]{};
+  size_t count_{0};
+  std::vector<uint64_t> masks_[MAX_DELIMITERS];
+};
+
+namespace detail {
+// each fills mask[d][i] for the first `words` 64-byte words
+
+inline void index_scalar(const char* p, size_t words, const char* delims,
+                         size_t count, std::vector<uint64_t>* masks) {
+  for (size_t w = 0; w < words; ++w) {
+    for (size_t d = 0; d < count; ++d) {
+      uint64_t bits = 0;
+      for (size_t i = 0; i < 64; ++i)
+        bits |= uint64_t(p[w * 64 + i] == delims[d]) << i;
+      masks[d][w] = bits;
+    }
+  }
+}
+
+#ifdef DARR_STRUCTURAL_X86
+inline void index_sse2(const char* p, size_t words, const char* delims,
+                       size_t count, std::vector<uint64_t>* masks) {
+  for (size_t w = 0; w < words; ++w, p += 64) {
+    __m128i in[4];
+    for (int k = 0; k < 4; ++k)
+      in[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * k));
+    for (size_t d = 0; d < count; ++d) {
+      __m128i c = _mm_set1_epi8(delims[d]);
+      uint64_t bits = 0;
+      for (int k = 0; k < 4; ++k)
+        bits |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(in[k], c))))
+                << (16 * k);
+      masks[d][w] = bits;
+    }
+  }
+}
+
+__attribute__((target("avx2"))) inline void index_avx2(
+    const char* p, size_t words, const char* delims, size_t count,
+    std::vector<uint64_t>* masks) {
+  for (size_t w = 0; w < words; ++w, p += 64) {
+    __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+    for (size_t d = 0; d < count; ++d) {
+      __m256i c = _mm256_set1_epi8(delims[d]);
+      uint32_t a = _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, c));
+      uint32_t b = _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, c));
+      masks[d][w] = uint64_t(a) | (uint64_t(b) << 32);
+    }
+  }
+}
+
+inline bool has_avx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+#endif
+}  // namespace detail
+
+inline void StructuralIndex::build(std::string_view text,
+                                   std::string_view delimiters) {
+  base_ = text.data();
+  size_ = text.size();
+  count_ = delimiters.size() < MAX_DELIMITERS ? delimiters.size()
+                                              : MAX_DELIMITERS;
+  std::memcpy(delimiters_, delimiters.data(), count_);
+
+  size_t words = (size_ + 63) / 64;
+  for (size_t d = 0; d < count_; ++d)
+    masks_[d].resize(words);
+
+  // whole words straight from the text; the last partial one
+  // from a zero-padded copy, so we never read past the end
+  size_t full = size_ / 64;
+#ifdef DARR_STRUCTURAL_X86
+  if (detail::has_avx2())
+    detail::index_avx2(base_, full, delimiters_, count_, masks_);
+  else
+    detail::index_sse2(base_, full, delimiters_, count_, masks_);
+#else
+  detail::index_scalar(base_, full, delimiters_, count_, masks_);
+#endif
+  if (full < words) {
+    char tail[64] = {};
+    std::memcpy(tail, base_ + full * 64, size_ - full * 64);
+    std::vector<uint64_t> last[MAX_DELIMITERS];
+    for (size_t d = 0; d < count_; ++d)
+      last[d].resize(1);
+    detail::index_scalar(tail, 1, delimiters_, count_, last);
+    // a '\0' delimiter mustn't match the padding
+    uint64_t valid = ~uint64_t(0) >> (64 - (size_ - full * 64));
+    for (size_t d = 0; d < count_; ++d)
+      masks_[d][full] = last[d][0] & valid;
+  }
+}
+
+}  // namespace darr